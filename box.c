@@ -0,0 +1,359 @@
+/* box drawing and block elements, drawn straight into cell sized bitmaps
+ * so that lines meet across cells whatever the font has */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <math.h>
+
+enum {
+	LEFT,
+	UP,
+	RIGHT,
+	DOWN
+};
+
+/* weight of an arm */
+enum {
+	N,	/* none */
+	L,	/* light */
+	H,	/* heavy */
+	D	/* double */
+};
+
+#define B(l, u, r, d) ((l) | (u) << 2 | (r) << 4 | (d) << 6)
+
+/* arms reaching out from the middle of the cell to each edge, 0 for the
+ * dashes, arcs and diagonals which are drawn by hand */
+static const uint8_t arms[128] = {
+	/* 2500 */ B(L, N, L, N), B(H, N, H, N), B(N, L, N, L), B(N, H, N, H),
+	/* 2504 */ 0, 0, 0, 0,
+	/* 2508 */ 0, 0, 0, 0,
+	/* 250c */ B(N, N, L, L), B(N, N, H, L), B(N, N, L, H), B(N, N, H, H),
+	/* 2510 */ B(L, N, N, L), B(H, N, N, L), B(L, N, N, H), B(H, N, N, H),
+	/* 2514 */ B(N, L, L, N), B(N, L, H, N), B(N, H, L, N), B(N, H, H, N),
+	/* 2518 */ B(L, L, N, N), B(H, L, N, N), B(L, H, N, N), B(H, H, N, N),
+	/* 251c */ B(N, L, L, L), B(N, L, H, L), B(N, H, L, L), B(N, L, L, H),
+	/* 2520 */ B(N, H, L, H), B(N, H, H, L), B(N, L, H, H), B(N, H, H, H),
+	/* 2524 */ B(L, L, N, L), B(H, L, N, L), B(L, H, N, L), B(L, L, N, H),
+	/* 2528 */ B(L, H, N, H), B(H, H, N, L), B(H, L, N, H), B(H, H, N, H),
+	/* 252c */ B(L, N, L, L), B(H, N, L, L), B(L, N, H, L), B(H, N, H, L),
+	/* 2530 */ B(L, N, L, H), B(H, N, L, H), B(L, N, H, H), B(H, N, H, H),
+	/* 2534 */ B(L, L, L, N), B(H, L, L, N), B(L, L, H, N), B(H, L, H, N),
+	/* 2538 */ B(L, H, L, N), B(H, H, L, N), B(L, H, H, N), B(H, H, H, N),
+	/* 253c */ B(L, L, L, L), B(H, L, L, L), B(L, L, H, L), B(H, L, H, L),
+	/* 2540 */ B(L, H, L, L), B(L, L, L, H), B(L, H, L, H), B(H, H, L, L),
+	/* 2544 */ B(L, H, H, L), B(H, L, L, H), B(L, L, H, H), B(H, H, H, L),
+	/* 2548 */ B(H, L, H, H), B(H, H, L, H), B(L, H, H, H), B(H, H, H, H),
+	/* 254c */ 0, 0, 0, 0,
+	/* 2550 */ B(D, N, D, N), B(N, D, N, D), B(N, N, D, L), B(N, N, L, D),
+	/* 2554 */ B(N, N, D, D), B(D, N, N, L), B(L, N, N, D), B(D, N, N, D),
+	/* 2558 */ B(N, L, D, N), B(N, D, L, N), B(N, D, D, N), B(D, L, N, N),
+	/* 255c */ B(L, D, N, N), B(D, D, N, N), B(N, L, D, L), B(N, D, L, D),
+	/* 2560 */ B(N, D, D, D), B(D, L, N, L), B(L, D, N, D), B(D, D, N, D),
+	/* 2564 */ B(D, N, D, L), B(L, N, L, D), B(D, N, D, D), B(D, L, D, N),
+	/* 2568 */ B(L, D, L, N), B(D, D, D, N), B(D, L, D, L), B(L, D, L, D),
+	/* 256c */ B(D, D, D, D), 0, 0, 0,
+	/* 2570 */ 0, 0, 0, 0,
+	/* 2574 */ B(L, N, N, N), B(N, L, N, N), B(N, N, L, N), B(N, N, N, L),
+	/* 2578 */ B(H, N, N, N), B(N, H, N, N), B(N, N, H, N), B(N, N, N, H),
+	/* 257c */ B(L, N, H, N), B(N, L, N, H), B(H, N, L, N), B(N, H, N, L)
+};
+
+struct box {
+	unsigned char *pixels;
+	int w, h;
+	int light, heavy;
+};
+
+static void put(struct box *b, int x, int y, float a)
+{
+	unsigned char *p = &b->pixels[y * b->w + x];
+	int v;
+
+	if (a <= 0.0f)
+		return;
+
+	v = a >= 1.0f ? 0xff : a * 0xff + 0.5f;
+	if (v > *p)
+		*p = v;
+}
+
+static void fill(struct box *b, int x0, int y0, int x1, int y1, int v)
+{
+	int x, y;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 > b->w)
+		x1 = b->w;
+	if (y1 > b->h)
+		y1 = b->h;
+
+	for (y = y0; y < y1; ++y)
+		for (x = x0; x < x1; ++x)
+			b->pixels[y * b->w + x] = v;
+}
+
+/* where the lines of an arm cross an axis of @size pixels */
+static int strokes(struct box *b, int weight, int size, int pos[2], int *t)
+{
+	switch (weight) {
+	case L:
+		*t = b->light;
+		pos[0] = (size - *t) / 2;
+		return 1;
+	case H:
+		*t = b->heavy;
+		pos[0] = (size - *t) / 2;
+		return 1;
+	case D:
+		*t = b->light;
+		pos[0] = (size - 3 * *t) / 2;
+		pos[1] = pos[0] + 2 * *t;
+		return 2;
+	}
+
+	return 0;
+}
+
+/* An arm runs from its edge to the lines crossing it. Lines of a double
+ * arm stop at the nearer line of a double arm on their side, or carry on
+ * to the further one if only the other side has a double arm, which makes
+ * the corners of double lines. */
+static void arm(struct box *b, uint8_t a, int d)
+{
+	int weight = a >> 2 * d & 3;
+	bool vertical = d == UP || d == DOWN;
+	bool low = d == LEFT || d == UP;
+	int along = vertical ? b->h : b->w;
+	int across = vertical ? b->w : b->h;
+	int side[2] = { vertical ? LEFT : UP, vertical ? RIGHT : DOWN };
+	int pos[2], q[2], t, qt, n, i, k, from, to;
+	int lo = along, hi = 0;
+
+	if (weight == N)
+		return;
+
+	for (i = 0; i < 2; ++i) {
+		n = strokes(b, a >> 2 * side[i] & 3, along, q, &qt);
+		if (n && q[0] < lo)
+			lo = q[0];
+		if (n && q[n - 1] + qt > hi)
+			hi = q[n - 1] + qt;
+	}
+
+	if (lo > hi) {
+		n = strokes(b, weight, along, q, &qt);
+		lo = q[0];
+		hi = q[n - 1] + qt;
+	}
+
+	n = strokes(b, weight, across, pos, &t);
+	for (k = 0; k < n; ++k) {
+		int mine = a >> 2 * side[k] & 3;
+		int other = a >> 2 * side[!k] & 3;
+
+		from = low ? 0 : lo;
+		to = low ? hi : along;
+
+		if (n == 2 && mine == D) {
+			strokes(b, D, along, q, &qt);
+			from = low ? 0 : q[1];
+			to = low ? q[0] + qt : along;
+		} else if (n == 2 && mine == N && other == D) {
+			strokes(b, D, along, q, &qt);
+			from = low ? 0 : q[0];
+			to = low ? q[1] + qt : along;
+		}
+
+		if (vertical)
+			fill(b, pos[k], from, pos[k] + t, to, 0xff);
+		else
+			fill(b, from, pos[k], to, pos[k] + t, 0xff);
+	}
+}
+
+/* @n dashes per cell with gaps split evenly at both ends */
+static void dash(struct box *b, int weight, int n, bool vertical)
+{
+	int along = vertical ? b->h : b->w;
+	int across = vertical ? b->w : b->h;
+	int pos[2], t, i, from, to, gap;
+
+	strokes(b, weight, across, pos, &t);
+	for (i = 0; i < n; ++i) {
+		from = i * along / n;
+		to = (i + 1) * along / n;
+		gap = (to - from) / 3;
+		if (gap < 1)
+			gap = 1;
+		from += gap / 2;
+		to -= gap - gap / 2;
+
+		if (vertical)
+			fill(b, pos[0], from, pos[0] + t, to, 0xff);
+		else
+			fill(b, from, pos[0], to, pos[0] + t, 0xff);
+	}
+}
+
+/* quarter circle joining the middle of the edges in directions @dx, @dy */
+static void arc(struct box *b, int dx, int dy)
+{
+	int pos[2], t, x, y;
+	float cx, cy, ox, oy, r;
+
+	strokes(b, L, b->w, pos, &t);
+	cx = pos[0] + t / 2.0f;
+	strokes(b, L, b->h, pos, &t);
+	cy = pos[0] + t / 2.0f;
+
+	r = fminf(fminf(cx, b->w - cx), fminf(cy, b->h - cy));
+	ox = cx + dx * r;
+	oy = cy + dy * r;
+
+	for (y = 0; y < b->h; ++y) {
+		for (x = 0; x < b->w; ++x) {
+			float px = x + 0.5f, py = y + 0.5f;
+
+			if ((px - ox) * dx > 0.0f || (py - oy) * dy > 0.0f)
+				continue;
+
+			put(b, x, y, t / 2.0f + 0.5f -
+			    fabsf(hypotf(px - ox, py - oy) - r));
+		}
+	}
+
+	x = cx - t / 2.0f;
+	y = cy - t / 2.0f;
+	if (dy > 0)
+		fill(b, x, oy, x + t, b->h, 0xff);
+	else
+		fill(b, x, 0, x + t, ceilf(oy), 0xff);
+
+	if (dx > 0)
+		fill(b, ox, y, b->w, y + t, 0xff);
+	else
+		fill(b, 0, y, ceilf(ox), y + t, 0xff);
+}
+
+/* corner to corner, @up goes from the lower left to the upper right */
+static void diagonal(struct box *b, bool up)
+{
+	float len = hypotf(b->w, b->h);
+	int x, y;
+
+	for (y = 0; y < b->h; ++y) {
+		for (x = 0; x < b->w; ++x) {
+			float px = x + 0.5f, py = y + 0.5f;
+			float d = up ? b->h * px + b->w * py - b->w * b->h :
+				       b->h * px - b->w * py;
+
+			put(b, x, y, b->light / 2.0f + 0.5f - fabsf(d) / len);
+		}
+	}
+}
+
+static void box_lines(struct box *b, uint32_t c)
+{
+	uint8_t a;
+	int d;
+
+	if (c >= 0x2504 && c <= 0x250b) {
+		dash(b, c & 1 ? H : L, c < 0x2508 ? 3 : 4, c & 2);
+		return;
+	}
+
+	if (c >= 0x254c && c <= 0x254f) {
+		dash(b, c & 1 ? H : L, 2, c & 2);
+		return;
+	}
+
+	switch (c) {
+	case 0x256d:
+		arc(b, 1, 1);
+		return;
+	case 0x256e:
+		arc(b, -1, 1);
+		return;
+	case 0x256f:
+		arc(b, -1, -1);
+		return;
+	case 0x2570:
+		arc(b, 1, -1);
+		return;
+	case 0x2571:
+		diagonal(b, true);
+		return;
+	case 0x2572:
+		diagonal(b, false);
+		return;
+	case 0x2573:
+		diagonal(b, true);
+		diagonal(b, false);
+		return;
+	}
+
+	a = arms[c - 0x2500];
+	for (d = LEFT; d <= DOWN; ++d)
+		arm(b, a, d);
+}
+
+/* upper left, upper right, lower left and lower right quarters */
+static const uint8_t quadrants[] = {
+	4, 8, 1, 1 | 4 | 8, 1 | 8, 1 | 2 | 4, 1 | 2 | 8, 2, 2 | 4, 2 | 4 | 8
+};
+
+static void box_blocks(struct box *b, uint32_t c)
+{
+	int w = b->w, h = b->h, q;
+
+	if (c == 0x2580) {
+		fill(b, 0, 0, w, h / 2, 0xff);
+	} else if (c <= 0x2588) {
+		fill(b, 0, h - (h * (c - 0x2580) + 4) / 8, w, h, 0xff);
+	} else if (c <= 0x258f) {
+		fill(b, 0, 0, (w * (0x2590 - c) + 4) / 8, h, 0xff);
+	} else if (c == 0x2590) {
+		fill(b, w / 2, 0, w, h, 0xff);
+	} else if (c <= 0x2593) {
+		fill(b, 0, 0, w, h, 0x40 * (c - 0x2590));
+	} else if (c == 0x2594) {
+		fill(b, 0, 0, w, (h + 4) / 8, 0xff);
+	} else if (c == 0x2595) {
+		fill(b, w - (w + 4) / 8, 0, w, h, 0xff);
+	} else {
+		q = quadrants[c - 0x2596];
+		if (q & 1)
+			fill(b, 0, 0, w / 2, h / 2, 0xff);
+		if (q & 2)
+			fill(b, w / 2, 0, w, h / 2, 0xff);
+		if (q & 4)
+			fill(b, 0, h / 2, w / 2, h, 0xff);
+		if (q & 8)
+			fill(b, w / 2, h / 2, w, h, 0xff);
+	}
+}
+
+/* Draws @c into the zeroed @w by @h bitmap if it is one of ours, @size is
+ * the pixel size of the font and sets the line width. */
+bool box_draw(uint32_t c, unsigned char *pixels, int w, int h, int size)
+{
+	struct box b = { pixels, w, h };
+
+	b.light = size / 12;
+	if (b.light < 1)
+		b.light = 1;
+	b.heavy = 2 * b.light + 1;
+
+	if (c >= 0x2500 && c < 0x2580)
+		box_lines(&b, c);
+	else if (c >= 0x2580 && c < 0x25a0)
+		box_blocks(&b, c);
+	else
+		return false;
+
+	return true;
+}
@@ -19,6 +19,8 @@
 
 #include "fallback.h"
 
+bool box_draw(uint32_t, unsigned char *, int, int, int);
+
 #ifdef DEBUG_GLYPH
 #include <assert.h>
 #else
@@ -28,7 +30,7 @@
 struct node {
 	bool red;
 	struct node *link[2];
-	uint32_t ch;
+	uint64_t ch;
 	unsigned char *bitmap;
 };
 
@@ -50,15 +52,68 @@ struct font {
 	/* format needed to map from glyph index to glyph */
 	int indextolocformat;
 
+	/* flattened cmap: pages of 256 glyph indices for the BMP and sorted
+	 * ranges above it, built once by flatten_cmap() */
+	bool flat;
+	uint16_t *bmp[256];
+	struct cmap_range {
+		uint32_t first, last;
+		uint32_t glyph;
+		int step;
+	} *astral;
+	int num_astral;
+
 	int width, height;
 	int ascent;
 	float scale;
 
-	struct node *cache;
+	/* fallback fonts are only opened once we look for a codepoint the
+	 * fonts before them do not have */
+	char *path;
+	bool loaded, failed;
 };
 
 static struct font font;
 
+/* styled faces, the regular one is font */
+enum {
+	FACE_BOLD = 1,
+	FACE_ITALIC = 2,
+	NUM_FACES = 4
+};
+
+static struct font faces[NUM_FACES];
+
+/* Rendered glyphs of each face, keyed by cell width and symbol id. The
+ * caches of the sizes used last are kept, so zooming back is free. */
+#define MAX_SIZES 4
+
+static struct size {
+	int pixel_size;
+	unsigned long used;
+	struct node *caches[NUM_FACES];
+} sizes[MAX_SIZES], *cur;
+
+static unsigned long size_clock;
+
+#define MAX_FALLBACKS 16
+
+static struct font fallbacks[MAX_FALLBACKS];
+static int num_fallbacks;
+static int pixel_size;
+
+/* codepoint -> font and glyph index, so every codepoint walks the fallback
+ * chain only once. open addressing, a zero key marks an empty slot, so
+ * codepoint 0 is never cached. */
+static struct {
+	struct resolved {
+		uint32_t c;
+		int16_t font;
+		uint16_t glyph;
+	} *slot;
+	uint32_t size, used;
+} resolved;
+
 enum {
 	VMOVE = 1,
 	VLINE,
@@ -85,9 +140,9 @@ struct bitmap {
 #define read_byte(p) (*(uint8_t *)(p))
 #define read_char(p) (*(int8_t *)(p))
 
-static uint16_t read_ushort(const uint8_t *p)
+static uint16_t read_ushort(const struct font *f, const uint8_t *p)
 {
-	if (p < font.data || p + 1 > font.data + font.size - 1) {
+	if (p < f->data || p + 1 > f->data + f->size - 1) {
 		fprintf(stderr, "font file is corrupt\n");
 		return 0;
 	}
@@ -95,9 +150,9 @@ static uint16_t read_ushort(const uint8_t *p)
 	return (p[0] << 8) + p[1];
 }
 
-static int16_t read_short(const uint8_t *p)
+static int16_t read_short(const struct font *f, const uint8_t *p)
 {
-	if (p < font.data || p + 1 > font.data + font.size - 1) {
+	if (p < f->data || p + 1 > f->data + f->size - 1) {
 		fprintf(stderr, "font file is corrupt\n");
 		return 0;
 	}
@@ -105,9 +160,9 @@ static int16_t read_short(const uint8_t *p)
 	return (p[0] << 8) + p[1];
 }
 
-static uint32_t read_ulong(const uint8_t *p)
+static uint32_t read_ulong(const struct font *f, const uint8_t *p)
 {
-	if (p < font.data || p + 3 > font.data + font.size - 1) {
+	if (p < f->data || p + 3 > f->data + f->size - 1) {
 		fprintf(stderr, "font file is corrupt\n");
 		return 0;
 	}
@@ -115,16 +170,16 @@ static uint32_t read_ulong(const uint8_t *p)
 	return p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
 }
 
-static uint32_t find_table(uint8_t *data, uint32_t fontstart, const char *tag)
+static uint32_t find_table(const struct font *f, const char *tag)
 {
-	int32_t i, num_tables = read_ushort(data + fontstart + 4);
-	uint32_t tabledir = fontstart + 12;
+	int32_t i, num_tables = read_ushort(f, f->data + f->fontstart + 4);
+	uint32_t tabledir = f->fontstart + 12;
 
 	for (i = 0; i < num_tables; ++i) {
-		uint8_t *loc = data + (tabledir + 16 * i);
+		uint8_t *loc = f->data + (tabledir + 16 * i);
 
 		if (strncmp((char *)loc, tag, 4) == 0)
-			return read_ulong(loc + 8);
+			return read_ulong(f, loc + 8);
 	}
 
 	return 0;
@@ -139,68 +194,81 @@ static int setup(struct font *f, int fontstart)
 	data = f->data;
 	f->fontstart = fontstart;
 
-	cmap = find_table(data, fontstart, "cmap");
-	f->loca = find_table(data, fontstart, "loca");
-	f->head = find_table(data, fontstart, "head");
-	f->glyf = find_table(data, fontstart, "glyf");
-	f->hhea = find_table(data, fontstart, "hhea");
-	f->hmtx = find_table(data, fontstart, "hmtx");
+	cmap = find_table(f, "cmap");
+	f->loca = find_table(f, "loca");
+	f->head = find_table(f, "head");
+	f->glyf = find_table(f, "glyf");
+	f->hhea = find_table(f, "hhea");
+	f->hmtx = find_table(f, "hmtx");
 	if (!cmap || !f->loca || !f->head || !f->glyf || !f->hhea || !f->hmtx)
 		return -1;
 
-	t = find_table(data, fontstart, "maxp");
+	t = find_table(f, "maxp");
 	if (t)
-		f->num_glyphs = read_ushort(data + t + 4);
+		f->num_glyphs = read_ushort(f, data + t + 4);
 	else
 		f->num_glyphs = 0xffff;
 
 	/* find a cmap encoding table we understand *now* to avoid searching
 	 * later. (todo: could make this installable)
 	 * the same regardless of glyph. */
-	num_tables = read_ushort(data + cmap + 2);
+	num_tables = read_ushort(f, data + cmap + 2);
 	f->index_map = 0;
 	for (i = 0; i < num_tables; ++i) {
 		uint32_t enc = cmap + 4 + 8 * i;
 
 		/* find an encoding we understand */
-		switch (read_ushort(data + enc)) {
+		switch (read_ushort(f, data + enc)) {
 		case STBTT_PLATFORM_ID_MICROSOFT:
-			switch (read_ushort(data + enc + 2)) {
+			switch (read_ushort(f, data + enc + 2)) {
 			case STBTT_MS_EID_UNICODE_BMP:
 			case STBTT_MS_EID_UNICODE_FULL:
 				f->index_map =
-					cmap + read_ulong(data + enc + 4);
+					cmap + read_ulong(f, data + enc + 4);
 				break;
 			}
 			break;
 		case STBTT_PLATFORM_ID_UNICODE:
 			/* all encodingIDs are unicode */
-			f->index_map = cmap + read_ulong(data + enc + 4);
+			f->index_map = cmap + read_ulong(f, data + enc + 4);
 			break;
 		}
 	}
 	if (f->index_map == 0)
 		return -1;
 
-	f->indextolocformat = read_ushort(data + f->head + 50);
+	f->indextolocformat = read_ushort(f, data + f->head + 50);
 	return 0;
 }
 
+/* number of format 12/13 groups, never more than actually fit in the file */
+static uint32_t cmap_groups(const struct font *f)
+{
+	uint32_t ngroups = read_ulong(f, f->data + f->index_map + 12);
+	size_t room;
+
+	if (f->size < (size_t)f->index_map + 16)
+		return 0;
+
+	room = (f->size - f->index_map - 16) / 12;
+	return ngroups < room ? ngroups : room;
+}
+
 static int find_index(const struct font *f, uint32_t codepoint)
 {
 	uint8_t *data = f->data;
 	uint32_t index_map = f->index_map;
-	uint16_t format = read_ushort(data + index_map + 0);
+	uint16_t format = read_ushort(f, data + index_map + 0);
 
 	if (format == 0) { /* apple byte encoding */
-		if (codepoint + 6 < read_ushort(data + index_map + 2))
+		if (codepoint + 6 < read_ushort(f, data + index_map + 2))
 			return read_byte(data + index_map + 6 + codepoint);
 		return 0;
 	} else if (format == 6) {
-		uint32_t first = read_ushort(data + index_map + 6);
-		uint32_t count = read_ushort(data + index_map + 8);
+		uint32_t first = read_ushort(f, data + index_map + 6);
+		uint32_t count = read_ushort(f, data + index_map + 8);
 		if (codepoint >= first && codepoint < first + count)
-			return read_ushort(data + index_map + 10
+			return read_ushort(f, data + index_map + 10
 					   + (codepoint - first) * 2);
 		return 0;
 	} else if (format == 2) {
@@ -210,10 +278,10 @@ static int find_index(const struct font *f, uint32_t codepoint)
 		 * collection of ranges */
 		uint16_t offset, start, last, item;
 		uint8_t *idx;
-		uint16_t segcount = read_ushort(data + index_map + 6) >> 1;
-		uint16_t range = read_ushort(data + index_map + 8) >> 1;
-		uint16_t selector = read_ushort(data + index_map + 10);
-		uint16_t shift = read_ushort(data + index_map + 12) >> 1;
+		uint16_t segcount = read_ushort(f, data + index_map + 6) >> 1;
+		uint16_t range = read_ushort(f, data + index_map + 8) >> 1;
+		uint16_t selector = read_ushort(f, data + index_map + 10);
+		uint16_t shift = read_ushort(f, data + index_map + 12) >> 1;
 
 		/* do a binary search of the segments */
 		uint32_t end_count = index_map + 14;
@@ -224,7 +292,7 @@ static int find_index(const struct font *f, uint32_t codepoint)
 
 		/* they lie from end_count .. end_count + segcount
 		 * but range is the nearest power of two, so... */
-		if (codepoint >= read_ushort(data + search + shift * 2))
+		if (codepoint >= read_ushort(f, data + search + shift * 2))
 			search += shift * 2;
 
 		/* now decrement to bias correctly to find smallest */
@@ -232,7 +300,7 @@ static int find_index(const struct font *f, uint32_t codepoint)
 		while (selector) {
 			uint16_t end;
 			range >>= 1;
-			end = read_ushort(data + search + range * 2);
+			end = read_ushort(f, data + search + range * 2);
 			if (codepoint > end)
 				search += range * 2;
 			--selector;
@@ -240,36 +308,36 @@ static int find_index(const struct font *f, uint32_t codepoint)
 
 		item = (search + 2 - end_count) >> 1;
 		idx = data + index_map + 14;
-		start = read_ushort(idx + segcount * 2 + 2 + 2 * item);
-		last = read_ushort(data + end_count + 2 * item);
+		start = read_ushort(f, idx + segcount * 2 + 2 + 2 * item);
+		last = read_ushort(f, data + end_count + 2 * item);
 		if (codepoint < start || codepoint > last)
 			return 0;
 
-		offset = read_ushort(idx + segcount * 6 + 2 + 2 * item);
+		offset = read_ushort(f, idx + segcount * 6 + 2 + 2 * item);
 		if (offset == 0)
-			return codepoint + read_short(idx + segcount * 4
+			return codepoint + read_short(f, idx + segcount * 4
 						      + 2 + 2 * item);
 
-		return read_ushort(data + offset + (codepoint - start) * 2
+		return read_ushort(f, data + offset + (codepoint - start) * 2
 				   + index_map + 14
 				   + segcount * 6 + 2 + 2 * item);
 	} else if (format == 12 || format == 13) {
-		uint32_t ngroups = read_ulong(data + index_map + 12);
+		uint32_t ngroups = cmap_groups(f);
 		int32_t low = 0, high = (int32_t)ngroups;
 		/* Binary search the right group. */
 		while (low < high) {
 			/* rounds down, so low <= mid < high */
 			int32_t mid = low + ((high - low) >> 1);
 			uint8_t *a = data + index_map + 16 + mid * 12;
-			uint32_t start_char = read_ulong(a);
-			uint32_t end_char = read_ulong(a + 4);
+			uint32_t start_char = read_ulong(f, a);
+			uint32_t end_char = read_ulong(f, a + 4);
 
 			if (codepoint < start_char) {
 				high = mid;
 			} else if (codepoint > end_char) {
 				low = mid + 1;
 			} else {
-				uint32_t startg = read_ulong(a + 8);
+				uint32_t startg = read_ulong(f, a + 8);
 				if (format == 12)
 					return startg + codepoint - start_char;
 				else /* format == 13 */
@@ -283,6 +351,241 @@ static int find_index(const struct font *f, uint32_t codepoint)
 	return 0;
 }
 
+static int cmap_set(struct font *f, uint32_t c, uint16_t glyph)
+{
+	uint16_t **page = &f->bmp[c >> 8];
+
+	if (glyph == 0)
+		return 0;
+
+	if (*page == NULL && (*page = calloc(256, sizeof **page)) == NULL)
+		return -1;
+
+	(*page)[c & 0xff] = glyph;
+	return 0;
+}
+
+static int cmap_add_range(struct font *f, uint32_t first, uint32_t last,
+			  uint32_t glyph, int step)
+{
+	struct cmap_range *r;
+
+	if (first <= 0xffff) {
+		for (; first <= last && first <= 0xffff; ++first, glyph += step)
+			if (cmap_set(f, first, glyph) < 0)
+				return -1;
+		if (first > last)
+			return 0;
+	}
+
+	r = realloc(f->astral, (f->num_astral + 1) * sizeof *r);
+	if (r == NULL)
+		return -1;
+
+	f->astral = r;
+	r = &r[f->num_astral++];
+	r->first = first;
+	r->last = last;
+	r->glyph = glyph;
+	r->step = step;
+	return 0;
+}
+
+static void free_cmap(struct font *f)
+{
+	int i;
+
+	for (i = 0; i < 256; ++i) {
+		free(f->bmp[i]);
+		f->bmp[i] = NULL;
+	}
+
+	free(f->astral);
+	f->astral = NULL;
+	f->num_astral = 0;
+	f->flat = false;
+}
+
+static int flatten_cmap_(struct font *f)
+{
+	uint8_t *data = f->data;
+	uint32_t index_map = f->index_map;
+	uint16_t format = read_ushort(f, data + index_map + 0);
+	uint32_t i, c;
+
+	if (format == 4) {
+		uint16_t segcount = read_ushort(f, data + index_map + 6) >> 1;
+		uint32_t ends = index_map + 14;
+		uint32_t starts = ends + segcount * 2 + 2;
+		uint32_t deltas = starts + segcount * 2;
+		uint32_t offsets = deltas + segcount * 2;
+
+		for (i = 0; i < segcount; ++i) {
+			uint16_t start = read_ushort(f, data + starts + 2 * i);
+			uint16_t end = read_ushort(f, data + ends + 2 * i);
+			uint16_t delta = read_ushort(f, data + deltas + 2 * i);
+			uint16_t offset = read_ushort(f, data + offsets + 2 * i);
+			uint8_t *glyphs = data + offsets + 2 * i + offset;
+
+			for (c = start; c <= end; ++c) {
+				uint16_t g = offset == 0 ? c + delta
+					: read_ushort(f, glyphs + (c - start) * 2);
+
+				if (cmap_set(f, c, g) < 0)
+					return -1;
+			}
+		}
+	} else if (format == 12 || format == 13) {
+		uint32_t ngroups = cmap_groups(f);
+
+		for (i = 0; i < ngroups; ++i) {
+			uint8_t *a = data + index_map + 16 + i * 12;
+			uint32_t first = read_ulong(f, a);
+			uint32_t last = read_ulong(f, a + 4);
+
+			if (last < first || last > 0x10ffff)
+				continue;
+
+			if (cmap_add_range(f, first, last, read_ulong(f, a + 8),
+					   format == 12) < 0)
+				return -1;
+		}
+	} else if (format == 0 || format == 6) {
+		/* small tables, just ask find_index() for what they cover */
+		uint32_t first = 0, count = 256;
+
+		if (format == 6) {
+			first = read_ushort(f, data + index_map + 6);
+			count = read_ushort(f, data + index_map + 8);
+		}
+
+		for (c = first; c < first + count; ++c)
+			if (cmap_set(f, c, find_index(f, c)) < 0)
+				return -1;
+	} else {
+		/* unsupported, leave lookups to find_index() */
+		return 1;
+	}
+
+	return 0;
+}
+
+/* turn the cmap into something a lookup is a couple of loads away from,
+ * falls back to searching the font for odd formats or if we run out of
+ * memory */
+static void flatten_cmap(struct font *f)
+{
+	int r = flatten_cmap_(f);
+
+	if (r < 0) {
+		fprintf(stderr, "could not flatten cmap, out of memory\n");
+		free_cmap(f);
+		return;
+	}
+
+	if (r > 0)
+		return;
+
+	f->flat = true;
+}
+
+static int map_codepoint(const struct font *f, uint32_t c)
+{
+	int low, high;
+
+	if (!f->flat)
+		return find_index(f, c);
+
+	if (c <= 0xffff)
+		return f->bmp[c >> 8] ? f->bmp[c >> 8][c & 0xff] : 0;
+
+	low = 0;
+	high = f->num_astral;
+	while (low < high) {
+		int mid = low + ((high - low) >> 1);
+		const struct cmap_range *r = &f->astral[mid];
+
+		if (c < r->first)
+			high = mid;
+		else if (c > r->last)
+			low = mid + 1;
+		else
+			return r->glyph + r->step * (c - r->first);
+	}
+
+	return 0;
+}
+
+/* Scratch memory for rasterizing a single glyph. Allocations are bumped
+ * off one block and all released at once by scratch_reset(). If a glyph
+ * needs more, the overflow goes into extra chunks, which are merged into
+ * one bigger block on reset, so once we have seen the biggest glyph no
+ * more allocations happen. */
+struct scratch_chunk {
+	struct scratch_chunk *next;
+};
+
+static _Thread_local struct {
+	char *base;
+	size_t used, size;
+	struct scratch_chunk *extra;
+	size_t demand;
+} scratch;
+
+static void *scratch_alloc(size_t size)
+{
+	struct scratch_chunk *c;
+
+	size = (size + 15) & ~(size_t)15;
+	scratch.demand += size;
+
+	if (scratch.used + size <= scratch.size) {
+		scratch.used += size;
+		return scratch.base + scratch.used - size;
+	}
+
+	c = malloc(sizeof(struct scratch_chunk) + 16 + size);
+	if (c == NULL)
+		return NULL;
+
+	c->next = scratch.extra;
+	scratch.extra = c;
+	return (char *)c + 16;
+}
+
+static void scratch_reset(void)
+{
+	struct scratch_chunk *c;
+	size_t size;
+	char *base;
+
+	if (scratch.extra) {
+		while ((c = scratch.extra)) {
+			scratch.extra = c->next;
+			free(c);
+		}
+
+		size = scratch.demand + scratch.demand / 2;
+		base = malloc(size);
+		if (base) {
+			free(scratch.base);
+			scratch.base = base;
+			scratch.size = size;
+		}
+	}
+
+	scratch.used = 0;
+	scratch.demand = 0;
+}
+
+static void scratch_free(void)
+{
+	scratch_reset();
+	free(scratch.base);
+	scratch.base = NULL;
+	scratch.size = 0;
+}
+
 static void vinit(struct vertex *v, uint8_t type, int32_t x, int32_t y,
 		  int32_t cx, int32_t cy)
 {
@@ -304,11 +607,11 @@ static int glyph_offset(const struct font *f, int glyph_index)
 		return -1; /* unknown index->glyph map format */
 
 	if (f->indextolocformat == 0) {
-		g1 = f->glyf + read_ushort(loc + glyph_index * 2) * 2;
-		g2 = f->glyf + read_ushort(loc + glyph_index * 2 + 2) * 2;
+		g1 = f->glyf + read_ushort(f, loc + glyph_index * 2) * 2;
+		g2 = f->glyf + read_ushort(f, loc + glyph_index * 2 + 2) * 2;
 	} else {
-		g1 = f->glyf + read_ulong(loc + glyph_index * 4);
-		g2 = f->glyf + read_ulong(loc + glyph_index * 4 + 4);
+		g1 = f->glyf + read_ulong(f, loc + glyph_index * 4);
+		g2 = f->glyf + read_ulong(f, loc + glyph_index * 4 + 4);
 	}
 
 	return g1 == g2 ? -1 : g1; /* if length is 0, return -1 */
@@ -353,7 +656,7 @@ static int glyph_shape(const struct font *f, int glyph_index,
 	if (g < 0)
 		return 0;
 
-	ncontours = read_short(f->data + g);
+	ncontours = read_short(f, f->data + g);
 	if (ncontours > 0) {
 		uint8_t flags = 0, flagcount;
 		int32_t ins, i, j = 0, m, n;
@@ -362,14 +665,14 @@ static int glyph_shape(const struct font *f, int glyph_index,
 		uint8_t *points;
 
 		contour_ends = (f->data + g + 10);
-		ins = read_ushort(f->data + g + 10 + ncontours * 2);
+		ins = read_ushort(f, f->data + g + 10 + ncontours * 2);
 		points = f->data + g + 10 + ncontours * 2 + 2 + ins;
 
-		n = 1 + read_ushort(contour_ends + ncontours * 2 - 2);
+		n = 1 + read_ushort(f, contour_ends + ncontours * 2 - 2);
 
 		/* a loose bound on how many vertices we might need */
 		m = n + 2 * ncontours;
-		vertices = malloc(m * sizeof(vertices[0]));
+		vertices = scratch_alloc(m * sizeof(vertices[0]));
 		if (vertices == NULL)
 			return 0;
 
@@ -472,7 +775,7 @@ static int glyph_shape(const struct font *f, int glyph_index,
 				}
 				vinit(&vertices[vcount++], VMOVE, sx, sy, 0, 0);
 				was_off = 0;
-				next_move = read_ushort(contour_ends + j * 2);
+				next_move = read_ushort(f, contour_ends + j * 2);
 				next_move += 1;
 				++j;
 			} else {
@@ -505,16 +808,16 @@ static int glyph_shape(const struct font *f, int glyph_index,
 			struct vertex *comp_verts = 0, *tmp = 0;
 			float mtx[6] = { 1, 0, 0, 1, 0, 0 }, m, n;
 
-			flags = read_short(comp);
+			flags = read_short(f, comp);
 			comp += 2;
-			gidx = read_short(comp);
+			gidx = read_short(f, comp);
 			comp += 2;
 
 			if (flags & 2) { /* XY values */
 				if (flags & 1) { /* shorts */
-					mtx[4] = read_short(comp);
+					mtx[4] = read_short(f, comp);
 					comp += 2;
-					mtx[5] = read_short(comp);
+					mtx[5] = read_short(f, comp);
 					comp += 2;
 				} else {
 					mtx[4] = read_char(comp);
@@ -528,25 +831,25 @@ static int glyph_shape(const struct font *f, int glyph_index,
 
 			if (flags & 1 << 3) {
 				/* WE_HAVE_A_SCALE */
-				mtx[0] = mtx[3] = read_short(comp) / 16384.0f;
+				mtx[0] = mtx[3] = read_short(f, comp) / 16384.0f;
 				comp += 2;
 				mtx[1] = mtx[2] = 0;
 			} else if (flags & 1 << 6) {
 				/* WE_HAVE_AN_X_AND_YSCALE */
-				mtx[0] = read_short(comp) / 16384.0f;
+				mtx[0] = read_short(f, comp) / 16384.0f;
 				comp += 2;
 				mtx[1] = mtx[2] = 0;
-				mtx[3] = read_short(comp) / 16384.0f;
+				mtx[3] = read_short(f, comp) / 16384.0f;
 				comp += 2;
 			} else if (flags & 1 << 7) {
 				/* WE_HAVE_A_TWO_BY_TWO */
-				mtx[0] = read_short(comp) / 16384.0f;
+				mtx[0] = read_short(f, comp) / 16384.0f;
 				comp += 2;
-				mtx[1] = read_short(comp) / 16384.0f;
+				mtx[1] = read_short(f, comp) / 16384.0f;
 				comp += 2;
-				mtx[2] = read_short(comp) / 16384.0f;
+				mtx[2] = read_short(f, comp) / 16384.0f;
 				comp += 2;
-				mtx[3] = read_short(comp) / 16384.0f;
+				mtx[3] = read_short(f, comp) / 16384.0f;
 				comp += 2;
 			}
 
@@ -574,25 +877,17 @@ static int glyph_shape(const struct font *f, int glyph_index,
 			}
 
 			/* Append vertices */
-			tmp = malloc((vcount + comp_num_verts)
-				      * sizeof(struct vertex));
-			if (tmp == NULL) {
-				if (vertices)
-					free(vertices);
-				if (comp_verts)
-					free(comp_verts);
+			tmp = scratch_alloc((vcount + comp_num_verts)
+					    * sizeof(struct vertex));
+			if (tmp == NULL)
 				return 0;
-			}
 
 			if (vcount > 0)
 				memcpy(tmp, vertices,
 				       vcount * sizeof(struct vertex));
 			memcpy(tmp + vcount, comp_verts,
 			       comp_num_verts * sizeof(struct vertex));
-			if (vertices)
-				free(vertices);
 			vertices = tmp;
-			free(comp_verts);
 			vcount += comp_num_verts;
 		}
 	} else {
@@ -605,17 +900,17 @@ static int glyph_shape(const struct font *f, int glyph_index,
 
 static int get_ascent(struct font *f)
 {
-	return read_short(f->data + f->hhea + 4);
+	return read_short(f, f->data + f->hhea + 4);
 }
 
 static int get_descent(struct font *f)
 {
-	return read_short(f->data + f->hhea + 6);
+	return read_short(f, f->data + f->hhea + 6);
 }
 
 static int get_linegap(struct font *f)
 {
-	return read_short(f->data + f->hhea + 8);
+	return read_short(f, f->data + f->hhea + 8);
 }
 
 static void get_glyph_origin(struct font *f, int glyph, int *x, int *y)
@@ -627,8 +922,8 @@ static void get_glyph_origin(struct font *f, int glyph, int *x, int *y)
 		return;
 	}
 
-	*x = floor(read_short(f->data + g + 2) * f->scale);
-	*y = floor(-read_short(f->data + g + 8) * f->scale);
+	*x = floor(read_short(f, f->data + g + 2) * f->scale);
+	*y = floor(-read_short(f, f->data + g + 8) * f->scale);
 }
 
 struct hheap_chunk {
@@ -650,7 +945,7 @@ static void *hheap_alloc(struct hheap *hh, size_t size)
 	} else {
 		if (hh->num_in_head_chunk == 0) {
 			int count = (size < 32 ? 2000 : size < 128 ? 800 : 100);
-			struct hheap_chunk *c = malloc(sizeof(*c) + size * count);
+			struct hheap_chunk *c = scratch_alloc(sizeof(*c) + size * count);
 			if (c == NULL)
 				return NULL;
 			c->next = hh->head;
@@ -668,16 +963,6 @@ static void hheap_free(struct hheap *hh, void *p)
 	hh->first_free = p;
 }
 
-static void hheap_cleanup(struct hheap *hh)
-{
-	struct hheap_chunk *c = hh->head;
-	while (c) {
-		struct hheap_chunk *n = c->next;
-		free(c);
-		c = n;
-	}
-}
-
 struct edge {
 	float x0, y0, x1, y1;
 	int invert;
@@ -958,10 +1243,13 @@ static void rasterize_sorted_edges(struct bitmap *result, struct edge *e,
 	float scanline_data[129], *scanline, *scanline2;
 
 	if (result->w > 64)
-		scanline = malloc((result->w * 2 + 1) * sizeof(float));
+		scanline = scratch_alloc((result->w * 2 + 1) * sizeof(float));
 	else
 		scanline = scanline_data;
 
+	if (scanline == NULL)
+		return;
+
 	scanline2 = scanline + result->w;
 
 	y = off_y;
@@ -1046,10 +1334,6 @@ static void rasterize_sorted_edges(struct bitmap *result, struct edge *e,
 		++j;
 	}
 
-	hheap_cleanup(&hh);
-
-	if (scanline != scanline_data)
-		free(scanline);
 }
 
 #define cmp(a, b) ((a)->y0 < (b)->y0)
@@ -1165,7 +1449,7 @@ static void rasterize(struct bitmap *result, struct point *pts, int *wcount,
 	for (i = 0; i < windings; ++i)
 		n += wcount[i];
 
-	e = malloc(sizeof(*e) * (n + 1)); /* inc sentinel */
+	e = scratch_alloc(sizeof(*e) * (n + 1)); /* inc sentinel */
 	if (e == 0)
 		return;
 	n = 0;
@@ -1201,8 +1485,6 @@ static void rasterize(struct bitmap *result, struct point *pts, int *wcount,
 	/* now, traverse the scanlines and find the intersections on each
 	 * scanline, use xor winding rule */
 	rasterize_sorted_edges(result, e, n, vsubsample, off_x, off_y);
-
-	free(e);
 }
 
 static void add_point(struct point *points, int n, float x, float y)
@@ -1261,7 +1543,7 @@ static struct point *flatten(struct vertex *vertices, int num_verts,
 	if (n == 0)
 		return 0;
 
-	*contour_lengths = malloc(sizeof(**contour_lengths) * n);
+	*contour_lengths = scratch_alloc(sizeof(**contour_lengths) * n);
 	if (*contour_lengths == 0) {
 		*num_contours = 0;
 		return 0;
@@ -1270,7 +1552,7 @@ static struct point *flatten(struct vertex *vertices, int num_verts,
 	for (pass = 0; pass < 2; ++pass) {
 		float x = 0, y = 0;
 		if (pass == 1) {
-			points = malloc(num_points * sizeof(points[0]));
+			points = scratch_alloc(num_points * sizeof(points[0]));
 			if (points == NULL)
 				goto error;
 		}
@@ -1309,8 +1591,6 @@ static struct point *flatten(struct vertex *vertices, int num_verts,
 
 	return points;
  error:
-	free(points);
-	free(*contour_lengths);
 	*contour_lengths = 0;
 	*num_contours = 0;
 	return NULL;
@@ -1330,20 +1610,26 @@ static void render(struct bitmap *result, float flatness_in_pixels,
 		rasterize(result, windings, winding_lengths, winding_count,
 			  scale_x, scale_y, shift_x, shift_y, x_off, y_off,
 			  invert);
-		free(winding_lengths);
-		free(windings);
 	}
 }
 
 static short get_bearing(struct font *f, int glyph)
 {
 	if (glyph < f->num_metrics)
-		return read_short(f->data + f->hmtx + 4 * glyph + 2);
+		return read_short(f, f->data + f->hmtx + 4 * glyph + 2);
 	else
-		return read_short(f->data + f->hmtx + 4 * f->num_metrics
+		return read_short(f, f->data + f->hmtx + 4 * f->num_metrics
 				  + 2 * (glyph - f->num_metrics));
 }
 
+static unsigned short get_advance(struct font *f, int glyph)
+{
+	if (glyph >= f->num_metrics)
+		glyph = f->num_metrics - 1;
+
+	return read_ushort(f, f->data + f->hmtx + 4 * glyph);
+}
+
 static void flip(struct node *node)
 {
 	node->red = true;
@@ -1371,20 +1657,17 @@ static struct node *rotate2(struct node *node, int dir)
 	return rotate(node, dir);
 }
 
-static struct node *new_entry(uint32_t ch, bool red, unsigned char *bitmap)
+static struct node *new_entry(struct node *n, bool red)
 {
-	struct node *n;
-
-	n = malloc(sizeof *n);
 	n->link[0] = n->link[1] = &leaf;
 	n->red = red;
-	n->ch = ch;
-	n->bitmap = bitmap;
 	return n;
 }
 
-static void cache(struct node **root, uint32_t ch, unsigned char *bitmap)
+/* @n comes with its key and bitmap set */
+static void cache(struct node **root, struct node *n)
 {
+	uint64_t ch = n->ch;
 	struct node fake = { false, { NULL, *root }, 0, NULL };
 	struct node *i = *root;
 	struct node *p, *g, *gg;
@@ -1395,7 +1678,7 @@ static void cache(struct node **root, uint32_t ch, unsigned char *bitmap)
 	last = 0;
 
 	if (*root == &leaf) {
-		*root = new_entry(ch, false, bitmap);
+		*root = new_entry(n, false);
 		return;
 	}
 
@@ -1404,7 +1687,7 @@ static void cache(struct node **root, uint32_t ch, unsigned char *bitmap)
 
 	for (; ; ) {
 		if (i == &leaf)
-			p->link[dir] = i = new_entry(ch, true, bitmap);
+			p->link[dir] = i = new_entry(n, true);
 		else if (i->link[0]->red && i->link[1]->red)
 			flip(i);
 
@@ -1441,11 +1724,10 @@ static void delete_cache(struct node *n)
 	delete_cache(n->link[0]);
 	delete_cache(n->link[1]);
 
-	free(n->bitmap);
 	free(n);
 }
 
-static unsigned char *lookup(struct node *n, uint32_t ch)
+static unsigned char *lookup(struct node *n, uint64_t ch)
 {
 	while (n) {
 		if (n->ch == ch) {
@@ -1457,137 +1739,455 @@ static unsigned char *lookup(struct node *n, uint32_t ch)
 	return NULL;
 }
 
-unsigned char *new_glyph(uint32_t id, uint32_t c, int cwidth)
+static int open_font(struct font *f, char *path)
+{
+	int fd;
+	struct stat st;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "could not open font file %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "could not fstat font file %s: %s\n", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	f->size = st.st_size;
+	f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->data == MAP_FAILED) {
+		fprintf(stderr, "could not mmap font file %s: %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	f->mmapped = true;
+	return 0;
+}
+
+static void close_font(struct font *f)
+{
+	if (f->mmapped)
+		munmap(f->data, f->size);
+	f->mmapped = false;
+}
+
+static void font_metrics(struct font *f)
+{
+	f->num_metrics = read_ushort(f, f->data + f->hhea + 34);
+	f->ascent = get_ascent(f);
+	f->scale = (float)pixel_size / (f->ascent - get_descent(f));
+	f->ascent = floor(f->scale * f->ascent);
+}
+
+static bool load_font(struct font *f)
+{
+	if (f->loaded)
+		return true;
+	if (f->failed || f->path == NULL)
+		return false;
+
+	if (open_font(f, f->path) < 0 || setup(f, 0) < 0) {
+		fprintf(stderr, "ignoring font %s\n", f->path);
+		close_font(f);
+		f->failed = true;
+		return false;
+	}
+
+	font_metrics(f);
+	flatten_cmap(f);
+	f->loaded = true;
+	return true;
+}
+
+static int resolve_grow(void)
+{
+	struct resolved *old = resolved.slot;
+	uint32_t i, j, size = resolved.size ? resolved.size * 2 : 1024;
+
+	resolved.slot = calloc(size, sizeof *resolved.slot);
+	if (resolved.slot == NULL) {
+		resolved.slot = old;
+		return -1;
+	}
+
+	for (i = 0; i < resolved.size; ++i) {
+		if (old[i].c == 0)
+			continue;
+		j = old[i].c * 2654435761u & (size - 1);
+		while (resolved.slot[j].c)
+			j = (j + 1) & (size - 1);
+		resolved.slot[j] = old[i];
+	}
+
+	free(old);
+	resolved.size = size;
+	return 0;
+}
+
+/* find the first font in the chain that has a glyph for @c, falling back
+ * to the .notdef glyph of the primary font */
+static struct font *resolve(uint32_t c, int *glyph)
+{
+	struct resolved *r = NULL;
+	int i, g;
+
+	if (c && (resolved.used * 2 < resolved.size || resolve_grow() == 0)) {
+		uint32_t j = c * 2654435761u & (resolved.size - 1);
+
+		while (resolved.slot[j].c && resolved.slot[j].c != c)
+			j = (j + 1) & (resolved.size - 1);
+
+		r = &resolved.slot[j];
+		if (r->c) {
+			*glyph = r->glyph;
+			return r->font < 0 ? &font : &fallbacks[r->font];
+		}
+	}
+
+	g = map_codepoint(&font, c);
+	for (i = 0; g == 0 && i < num_fallbacks; ++i)
+		if (load_font(&fallbacks[i]))
+			g = map_codepoint(&fallbacks[i], c);
+	if (g == 0)
+		i = 0;
+
+	if (r) {
+		r->c = c;
+		r->font = i - 1;
+		r->glyph = g;
+		resolved.used++;
+	}
+
+	*glyph = g;
+	return i == 0 ? &font : &fallbacks[i - 1];
+}
+
+int font_set_face(int face, char *path)
+{
+	struct font *f;
+
+	if (face <= 0 || face >= NUM_FACES)
+		return -1;
+
+	f = &faces[face];
+	free(f->path);
+	f->path = strdup(path);
+	return f->path ? 0 : -1;
+}
+
+int font_add_fallback(char *path)
+{
+	struct font *f;
+
+	if (num_fallbacks == MAX_FALLBACKS) {
+		fprintf(stderr, "too many fallback fonts, ignoring %s\n", path);
+		return -1;
+	}
+
+	f = &fallbacks[num_fallbacks];
+	f->path = strdup(path);
+	if (f->path == NULL)
+		return -1;
+
+	num_fallbacks++;
+	return 0;
+}
+
+/* find a font for @c in @face, using the closest face we have and making
+ * up the rest of the style in @synth */
+static struct font *resolve_face(uint32_t c, int face, int *glyph,
+				 int *synth)
+{
+	int try[] = { face, face & FACE_ITALIC, face & FACE_BOLD };
+	size_t i;
+
+	for (i = 0; i < sizeof try / sizeof try[0]; ++i) {
+		struct font *f = &faces[try[i]];
+
+		if (try[i] && load_font(f) && (*glyph = map_codepoint(f, c))) {
+			*synth = face & ~try[i];
+			return f;
+		}
+	}
+
+	*synth = face;
+	return resolve(c, glyph);
+}
+
+static void slant(struct vertex *v, int n)
+{
+	for (; n--; ++v) {
+		v->x += v->y / 5;
+		v->cx += v->cy / 5;
+	}
+}
+
+/* smear every row to the right, about a pixel per 20 pixels of size */
+static void embolden(struct bitmap *bm)
+{
+	int x, y, i, n = pixel_size / 20 + 1;
+
+	for (y = 0; y < bm->h; ++y) {
+		unsigned char *row = bm->pixels + y * bm->stride;
+
+		for (x = bm->w - 1; x > 0; --x)
+			for (i = 1; i <= n && i <= x; ++i)
+				if (row[x - i] > row[x])
+					row[x] = row[x - i];
+	}
+}
+
+/* coverage goes through this once before a glyph is cached */
+static unsigned char coverage[256];
+static bool coverage_set;
+
+/* Gamma above 1 thickens light text on dark backgrounds, contrast from -1
+ * to 1 pushes partly covered pixels towards empty or full. */
+void font_set_coverage(float gamma, float contrast)
+{
+	int i;
+
+	coverage_set = gamma != 1.0f || contrast != 0.0f;
+
+	for (i = 0; i < 256; ++i) {
+		float v = powf(i / 255.0f, 1.0f / gamma);
+
+		v += contrast * v * (1.0f - v);
+		coverage[i] = v * 255.0f + 0.5f;
+	}
+}
+
+/* draws @c with its origin @x pixels into the cell, returns its advance */
+static float draw_outline(struct bitmap *bm, uint32_t c, int face, float x)
 {
 	struct vertex *vertices;
-	int xmin, ymin;
-	int glyph = find_index(&font, c);
-	float leftb = get_bearing(&font, glyph) * font.scale;
-	int vcount = glyph_shape(&font, glyph, &vertices);
+	int xmin, ymin, glyph, synth;
+	struct font *f = resolve_face(c, face, &glyph, &synth);
+	float leftb = get_bearing(f, glyph) * f->scale;
+	int vcount = glyph_shape(f, glyph, &vertices);
+
+	if (synth & FACE_ITALIC)
+		slant(vertices, vcount);
+
+	get_glyph_origin(f, glyph, &xmin, &ymin);
+	render(bm, 0.35f, vertices, vcount, f->scale, f->scale,
+	       x + leftb, font.ascent + ymin, xmin, ymin, 1);
+
+	if (synth & FACE_BOLD)
+		embolden(bm);
+
+	return get_advance(f, glyph) * f->scale;
+}
+
+/* Marks are drawn on their own and merged onto the base. Marks without an
+ * advance hang left of their origin, so they go where the base ends. */
+static void draw_mark(struct bitmap *bm, uint32_t c, int face, float x)
+{
+	struct bitmap mark = *bm;
+	int glyph, synth, i;
+	struct font *f = resolve_face(c, face, &glyph, &synth);
+
+	mark.pixels = scratch_alloc(bm->w * bm->h);
+	if (mark.pixels == NULL)
+		return;
+	memset(mark.pixels, 0, bm->w * bm->h);
+
+	draw_outline(&mark, c, face, get_advance(f, glyph) ? 0.0f : x);
+
+	for (i = 0; i < bm->w * bm->h; ++i)
+		if (mark.pixels[i] > bm->pixels[i])
+			bm->pixels[i] = mark.pixels[i];
+}
+
+/* @ch holds the @len codepoints of symbol @id, a base and its marks */
+unsigned char *new_glyph(uint64_t id, const uint32_t *ch, size_t len,
+			 int cwidth, int face)
+{
+	struct node *n;
 	struct bitmap bm = {
 		font.width * cwidth,
 		font.height,
 		font.width * cwidth,
 		NULL
 	};
+	float x;
+	size_t i;
+
+	/* the bitmap lives right behind its cache node, everything else
+	 * comes from the scratch arena */
+	n = calloc(1, sizeof *n + bm.w * bm.h);
+	if (n == NULL)
+		return NULL;
+	n->ch = (uint64_t)cwidth << 62 | id;
+	n->bitmap = bm.pixels = (unsigned char *)(n + 1);
+
+	/* lines and blocks are drawn to fill the cell exactly */
+	if (box_draw(ch[0], bm.pixels, bm.w, bm.h, pixel_size))
+		x = bm.w;
+	else
+		x = draw_outline(&bm, ch[0], face, 0.0f);
 
-	bm.pixels = calloc(1, bm.w * bm.h);
+	for (i = 1; i < len; ++i)
+		draw_mark(&bm, ch[i], face, x);
 
-	get_glyph_origin(&font, glyph, &xmin, &ymin);
-	render(&bm, 0.35f, vertices, vcount, font.scale, font.scale,
-	       leftb, font.ascent + ymin, xmin, ymin, 1);
+	if (coverage_set)
+		for (i = 0; i < (size_t)(bm.w * bm.h); ++i)
+			bm.pixels[i] = coverage[bm.pixels[i]];
 
-	free(vertices);
+	scratch_reset();
 
-	cache(&font.cache, id, bm.pixels);
+	cache(&cur->caches[face], n);
 	return bm.pixels;
 }
 
-unsigned char *get_glyph(uint32_t id, uint32_t c, int cwidth)
+unsigned char *get_glyph(uint64_t id, const uint32_t *ch, size_t len,
+			 int cwidth, int face)
 {
-	unsigned char *buf = lookup(font.cache, id);
+	unsigned char *buf;
+
+	face &= NUM_FACES - 1;
+	buf = lookup(cur->caches[face], (uint64_t)cwidth << 62 | id);
 
 	if (buf)
 		return buf;
 	else
-		return new_glyph(id, c, cwidth);
+		return new_glyph(id, ch, len, cwidth, face);
 }
 
 static int get_width(struct font *f)
 {
-	int i = find_index(f, 'W');
+	int i = map_codepoint(f, 'W');
 	short advance;
 
 	if (i < f->num_metrics) {
-		advance = read_short(f->data + f->hmtx + 4 * i);
+		advance = read_short(f, f->data + f->hmtx + 4 * i);
 	} else {
-		advance = read_short(f->data + f->hmtx);
+		advance = read_short(f, f->data + f->hmtx);
 	}
 
 	return advance;
 }
 
-static void open_font(char *path)
+/* the cache of @size, the one used least recently makes way if needed */
+static struct size *size_cache(int size)
 {
-	int fd;
-	struct stat st;
-
-	if (path == NULL || *path == '\0')
-		goto fb;
-
-	fd = open(path, O_RDONLY);
-	if (fd < 0) {
-		fprintf(stderr, "could not open font file: %s\n",
-			strerror(errno));
-		goto err;
+	struct size *s = &sizes[0];
+	int i;
+
+	for (i = 0; i < MAX_SIZES; ++i) {
+		if (sizes[i].pixel_size == size)
+			return &sizes[i];
+		if (sizes[i].used < s->used)
+			s = &sizes[i];
 	}
 
-	if (fstat(fd, &st) < 0) {
-		fprintf(stderr, "could not fstat font file: %s\n",
-			strerror(errno));
-		close(fd);
-		goto err;
+	for (i = 0; i < NUM_FACES; ++i) {
+		if (s->pixel_size)
+			delete_cache(s->caches[i]);
+		s->caches[i] = &leaf;
 	}
-
-	font.size = st.st_size;
-	font.data = mmap(NULL, font.size, PROT_READ, MAP_PRIVATE, fd, 0);
-	close(fd);
-	if (font.data == MAP_FAILED) {
-		fprintf(stderr, "could not mmap font file: %s\n",
-			strerror(errno));
-		goto err;
-	}
-	font.mmapped = true;
-	return;
-
-err:
-	fprintf(stderr, "using fallback font\n");
-fb:
-	font.size = sizeof(fallback);
-	font.data = &fallback[0];
-	font.mmapped = false;
+	s->pixel_size = size;
+	return s;
 }
 
-static void close_font(void)
+/* switches to glyphs of @size pixels, @w and @h get the new cell size */
+void font_set_size(int size, int *w, int *h)
 {
-	if (font.mmapped)
-		munmap(font.data, font.size);
-}
+	int ascent, descent, linegap, i;
 
-int font_init(int size, char *path, int *w, int *h)
-{
-	int descent, linegap;
-
-	open_font(path);
-
-	if (setup(&font, 0) < 0) {
-		close_font();
-		return -1;
+	/* windows switch back and forth before every frame */
+	if (cur && size == pixel_size) {
+		cur->used = ++size_clock;
+		*w = font.width;
+		*h = font.height;
+		return;
 	}
 
-	font.num_metrics = read_ushort(font.data + font.hhea + 34);
-	font.cache = &leaf;
+	pixel_size = size;
+	cur = size_cache(size);
+	cur->used = ++size_clock;
+
+	font_metrics(&font);
+	for (i = 1; i < NUM_FACES; ++i)
+		if (faces[i].loaded)
+			font_metrics(&faces[i]);
+	for (i = 0; i < num_fallbacks; ++i)
+		if (fallbacks[i].loaded)
+			font_metrics(&fallbacks[i]);
 
-	font.ascent = get_ascent(&font);
 	descent = get_descent(&font);
 	linegap = get_linegap(&font);
-	font.scale = (float)size / (font.ascent - descent);
+	ascent = get_ascent(&font);
 
-	font.height = font.ascent - descent + linegap;
+	font.height = ascent - descent + linegap;
 	font.width = get_width(&font);
 
-	font.ascent = floor(font.scale * font.ascent);
 	font.width = ceil(font.scale * font.width);
 	font.height = ceil(font.scale * font.height);
 
 	*w = font.width;
 	*h = font.height;
+}
+
+int font_init(int size, char *path, int *w, int *h)
+{
+	if (path == NULL || *path == '\0' || open_font(&font, path) < 0) {
+		if (path && *path)
+			fprintf(stderr, "using fallback font\n");
+		font.size = sizeof(fallback);
+		font.data = &fallback[0];
+		font.mmapped = false;
+	}
+
+	if (setup(&font, 0) < 0) {
+		close_font(&font);
+		return -1;
+	}
+
+	flatten_cmap(&font);
+	font_set_size(size, w, h);
 
 	return 0;
 }
 
 void font_deinit(void)
 {
-	delete_cache(font.cache);
-	close_font();
+	int i, j;
+
+	for (i = 0; i < MAX_SIZES; ++i) {
+		for (j = 0; j < NUM_FACES && sizes[i].pixel_size; ++j)
+			delete_cache(sizes[i].caches[j]);
+		sizes[i].pixel_size = 0;
+		sizes[i].used = 0;
+	}
+	cur = NULL;
+	free_cmap(&font);
+	close_font(&font);
+
+	for (i = 1; i < NUM_FACES; ++i) {
+		free_cmap(&faces[i]);
+		close_font(&faces[i]);
+		free(faces[i].path);
+		faces[i].path = NULL;
+		faces[i].loaded = faces[i].failed = false;
+	}
+
+	for (i = 0; i < num_fallbacks; ++i) {
+		free_cmap(&fallbacks[i]);
+		close_font(&fallbacks[i]);
+		free(fallbacks[i].path);
+	}
+	num_fallbacks = 0;
+
+	scratch_free();
+
+	free(resolved.slot);
+	resolved.slot = NULL;
+	resolved.size = resolved.used = 0;
 }
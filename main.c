@@ -9,8 +9,11 @@
 #include <limits.h>
 #include <time.h>
 #include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "ptyutil.h"
@@ -27,9 +30,50 @@
 
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 
+/* repaints touching fewer cells than this are drawn on the calling thread */
+#define RENDER_PARALLEL_MIN 2048
+#define RENDER_THREADS_MAX 7
+
+/* the compositor may hold on to more than two buffers at a time */
+#define NUM_BUFFERS 4
+
+/* number of frames whose damaged rows are remembered */
+#define DAMAGE_HISTORY 8
+
+/* scrolls since the last frame beyond which we repaint everything */
+#define MAX_SCROLLS 32
+
+/* longest we hold back frames for an application updating synchronized */
+#define SYNC_TIMEOUT 150
+
+/* how long the grid has to keep its size before the application is told */
+#define WINCH_DELAY 50
+
+/* clipboard transfers in flight at once, and bytes written per wakeup */
+#define MAX_SENDS 16
+#define SEND_BURST (64 * 1024)
+
+/* clients of the server whose requests are still coming in */
+#define MAX_CLIENTS 8
+
 int font_init(int, char *, int *, int *);
+int font_add_fallback(char *);
+int font_set_face(int, char *);
+void font_set_size(int, int *, int *);
+void font_set_coverage(float, float);
 void font_deinit(void);
-unsigned char *get_glyph(uint32_t, uint32_t, int);
+unsigned char *get_glyph(uint64_t, const uint32_t *, size_t, int, int);
+
+int client_main(char *[]);
+int server_listen(void);
+struct request *server_accept(int);
+int server_fd(struct request *);
+int server_read(struct request *, char ***, char **);
+void server_done(struct request *, bool);
+
+/* font faces, or'ed together */
+#define FACE_BOLD 1
+#define FACE_ITALIC 2
 
 enum deco {
 	DECO_AUTO,
@@ -37,44 +81,104 @@ enum deco {
 	DECO_NONE
 };
 
+/* fixed pollfds in front of those of the terminals */
 enum evfd {
 	EV_DISPLAY,
-	EV_TTY,
-	EV_PASTE,
+	EV_LISTEN,
 	NUM_POLLFDS,
 };
 
-static struct {
+/* pollfds of every terminal */
+enum {
+	TERM_TTY,
+	TERM_PASTE,
+	TERM_POLLFDS,
+};
+
+/* a window with its pty, the screen it shows and the buffers it is drawn
+ * into, everything else is shared by all of them */
+struct terminal {
+	struct terminal *next;
+
 	bool die;
 	bool configured;
 	bool need_redraw;
 	bool can_redraw;
-	int resize;
+	/* the window or the cells changed size, the grid is fitted to them
+	 * with the next frame */
+	bool need_resize;
+	/* when the application began a synchronized update, 0 if it
+	 * is not in one */
+	long long sync;
+	/* synchronized updates that ended as of the last look */
+	unsigned int syncs;
+	/* when the grid last changed size, 0 once the application knows */
+	long long winch;
 
 	int master_fd;
 
-	struct wl_display *display;
-	struct wl_registry *registry;
-	struct wl_compositor *cp;
-	struct wl_shm *shm;
-	bool shm_argb;
-	struct xdg_wm_base *wm_base;
-	struct wl_seat *seat;
+	struct {
+		char *data;
+		size_t head, len, size;
+	} out;
+
+	/* the pty is read and parsed on its own thread, everything touching
+	 * the screen, the vte or the output buffer must hold the lock */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t lock;
+		bool running;
+		bool quit;
+		bool hangup;
+		bool notified;
+		int wake[2];
+		int notify[2];
+	} parser;
 
 	struct wl_surface *surf;
 	struct xdg_surface *xdgsurf;
 	struct xdg_toplevel *toplvl;
+	struct zxdg_toplevel_decoration_v1 *deco;
+
+	/* all buffers are carved out of one shm pool, which only ever grows,
+	 * so resizing does not have to map new memory every time */
+	struct {
+		struct wl_shm_pool *pool;
+		int fd;
+		void *data;
+		size_t size, used;
+	} pool;
 
 	struct buffer {
 		struct wl_buffer *b;
 		void *data;
-		int size;
+		size_t offset, size;
+		int width, height;
 		bool busy;
 		tsm_age_t age;
-	} buf[2];
+		unsigned frame;
+		/* the search prompt was painted over the bottom row */
+		bool prompt;
+	} buf[NUM_BUFFERS];
+	struct buffer *front;
+
+	/* rows drawn in each of the last few frames, used to bring a stale
+	 * buffer up to date by copying from the front buffer */
+	struct {
+		struct damage {
+			unsigned frame;
+			bool full;
+			uint8_t *rows;
+			int size;
+		} hist[DAMAGE_HISTORY];
+		uint8_t *rows;
+		int size;
+		unsigned frame;
+	} damage;
 	struct wl_callback *cb;
 
 	int col, row;
+	int font_size;
 	int cwidth, cheight;
 	int width, height;
 	int confwidth, confheight;
@@ -84,6 +188,106 @@ static struct {
 
 	struct tsm_screen *screen;
 	struct tsm_vte *vte;
+
+	enum {
+		SS_RESET,
+		SS_ANCHORED,
+		SS_DRAGGING,
+		SS_ACTIVE
+	} selection;
+
+	struct {
+		int count;
+		int x, y;
+	} click;
+
+	struct {
+		struct wl_data_source *source;
+		struct tsm_screen_selection_reader *sel;
+	} d_copy;
+
+	struct {
+		struct zwp_primary_selection_source_v1 *source;
+		struct tsm_screen_selection_reader *sel;
+	} ps_copy;
+
+	struct {
+		int fd[2];
+		char buf[200];
+		size_t len;
+		bool active;
+	} paste;
+
+	/* prompt on the bottom row, keys go there while it is open */
+	struct {
+		bool active;
+		bool missing;
+		uint32_t buf[256];
+		size_t len;
+	} search;
+};
+
+static struct {
+	/* the display went away */
+	bool die;
+
+	/* where keys and pointer events go */
+	struct terminal *kbd_focus, *ptr_focus;
+
+	struct terminal *terms;
+	int num_terms;
+
+	/* the fixed ones, those of every terminal, then the transfers */
+	struct pollfd *pollfds;
+	/* clients of the server ask for windows here */
+	int listen_fd;
+
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *cp;
+	struct wl_shm *shm;
+	bool shm_argb;
+	struct xdg_wm_base *wm_base;
+	struct wl_seat *seat;
+	struct zxdg_decoration_manager_v1 *deco_manager;
+
+	/* cells to draw in the frame being rendered */
+	struct {
+		struct dirty {
+			uint64_t id;
+			uint32_t ch;
+			/* all codepoints of combined symbols, these live in
+			 * the symbol table until the next frame is drawn */
+			const uint32_t *seq;
+			int len, width;
+			int x, y;
+			struct tsm_screen_attr attr;
+			unsigned char *glyph;
+		} *cell;
+		int len, size;
+	} dirty;
+
+	/* scrolls to replay on the buffer before drawing the dirty cells */
+	struct {
+		struct tsm_screen_scroll op[MAX_SCROLLS];
+		int len;
+	} scroll;
+
+	/* large repaints are split into row bands and drawn in parallel */
+	struct {
+		pthread_t thread[RENDER_THREADS_MAX];
+		int num;
+		bool started;
+		pthread_mutex_t lock;
+		pthread_cond_t start, done;
+		unsigned gen;
+		bool quit;
+		struct terminal *term;
+		struct buffer *buffer;
+		int band[(RENDER_THREADS_MAX + 1) * 2 + 1];
+		int bands, next, pending;
+	} render;
+
 	unsigned int mods;
 
 	struct xkb_context *xkb_ctx;
@@ -99,18 +303,6 @@ static struct {
 	struct wl_pointer *ptr;
 	wl_fixed_t ptr_x, ptr_y;
 
-	enum {
-		SS_RESET,
-		SS_ANCHORED,
-		SS_DRAGGING,
-		SS_ACTIVE
-	} selection;
-
-	struct {
-		int count;
-		int x, y;
-	} click;
-
 	struct {
 		struct wl_cursor_theme *theme;
 		struct wl_cursor *text;
@@ -128,7 +320,7 @@ static struct {
 		uint32_t key;
 		xkb_keysym_t sym;
 		uint32_t unicode;
-		void (*action)(void);
+		void (*action)(struct terminal *);
 	} repeat;
 
 	struct wl_data_device_manager *d_dm;
@@ -136,35 +328,32 @@ static struct {
 	struct zwp_primary_selection_device_manager_v1 *ps_dm;
 	struct zwp_primary_selection_device_v1 *ps_d;
 
-	struct {
-		struct wl_data_source *source;
-		char *data;
-	} d_copy;
-
-	struct {
-		struct zwp_primary_selection_source_v1 *source;
-		char *data;
-	} ps_copy;
+	/* selections being written to other clients, each reads the screen
+	 * of the terminal it was copied from */
+	struct send {
+		int fd;
+		struct terminal *term;
+		struct tsm_screen_selection_reader *sel;
+		char buf[4096];
+		size_t len, off;
+	} send[MAX_SENDS];
+	int num_sends;
+
+	/* clients of the server, oldest first */
+	struct request *client[MAX_CLIENTS];
+	int num_clients;
 
 	struct {
 		struct wl_data_offer *d_offer;
 		struct zwp_primary_selection_offer_v1 *ps_offer;
 		char *d_mime;
 		char *ps_mime;
-
-		int fd[2];
-		char buf[200];
-		size_t len;
-		bool active;
 	} paste;
 
-	struct {
-		struct zxdg_decoration_manager_v1 *manager;
-		struct zxdg_toplevel_decoration_v1 *deco;
-	} deco;
-
 	struct {
 		bool linger;
+		bool server;
+		bool client;
 		char *config;
 		char *display;
 		char *app_id;
@@ -174,7 +363,7 @@ static struct {
 		struct binding *next;
 		unsigned int mods;
 		xkb_keysym_t sym;
-		void (*action)(void);
+		void (*action)(struct terminal *);
 	} *binding;
 
 	struct {
@@ -183,13 +372,19 @@ static struct {
 		int scrollback;
 		bool scroll_to_bottom_on_input;
 		bool margin;
+		bool copy_damage;
 		unsigned char opacity;
 		enum deco decorations;
 		int font_size;
 		char font_path[512];
+		float gamma, contrast;
 		uint8_t colors[TSM_COLOR_NUM][3];
 	} cfg;
-} term = {
+} ctx = {
+	.listen_fd = -1,
+	.render.lock = PTHREAD_MUTEX_INITIALIZER,
+	.render.start = PTHREAD_COND_INITIALIZER,
+	.render.done = PTHREAD_COND_INITIALIZER,
 	.cfg.shell = "/bin/sh",
 	.cfg.col = 80,
 	.cfg.row = 24,
@@ -200,6 +395,7 @@ static struct {
 	.cfg.decorations = DECO_AUTO,
 	.cfg.font_size = 18,
 	.cfg.font_path = "",
+	.cfg.gamma = 1.0f,
 	.cfg.colors = {
 		[TSM_COLOR_BLACK]         = {   0,   0,   0 },
 		[TSM_COLOR_RED]           = { 205,   0,   0 },
@@ -225,47 +421,233 @@ static struct {
 
 #define error(s) { fprintf(stderr, s ": %s\n", strerror(errno)); }
 
+/* Data for the child is queued in a ring buffer and written out in one go
+ * before we poll again or once the pty becomes writable. The buffer grows up to
+ * OUT_MAX, after that input is dropped. Once more than OUT_HIGH bytes are
+ * pending we stop reading from paste pipes until the child catches up. */
+#define OUT_MIN 4096
+#define OUT_HIGH (64 * 1024)
+#define OUT_MAX (1024 * 1024)
+
+static int out_grow(struct terminal *term, size_t need)
+{
+	size_t size = term->out.size ? term->out.size : OUT_MIN;
+	size_t tail;
+	char *data;
+
+	while (size < need)
+		size *= 2;
+
+	if (size > OUT_MAX)
+		return -1;
+
+	data = malloc(size);
+	if (data == NULL)
+		return -1;
+
+	tail = term->out.size - term->out.head;
+	if (tail > term->out.len)
+		tail = term->out.len;
+	if (term->out.len) {
+		memcpy(data, term->out.data + term->out.head, tail);
+		memcpy(data + tail, term->out.data, term->out.len - tail);
+	}
+
+	free(term->out.data);
+	term->out.data = data;
+	term->out.size = size;
+	term->out.head = 0;
+	return 0;
+}
+
 static void wcb(struct tsm_vte *vte, const char *u8, size_t len, void *data)
 {
-	assert(len <= PIPE_BUF);
-	if (term.master_fd >= 0 && write(term.master_fd, u8, len) < 0)
-		error("could not write to pty master");
+	struct terminal *term = data;
+	size_t pos, n;
+
+	if (term->master_fd < 0 || len == 0)
+		return;
+
+	if (term->out.len + len > term->out.size &&
+	    out_grow(term, term->out.len + len) < 0) {
+		fprintf(stderr, "pty output buffer full, dropping input\n");
+		return;
+	}
+
+	pos = (term->out.head + term->out.len) & (term->out.size - 1);
+	n = term->out.size - pos;
+	if (n > len)
+		n = len;
+
+	memcpy(term->out.data + pos, u8, n);
+	memcpy(term->out.data, u8 + n, len - n);
+	term->out.len += len;
 }
 
+static void tty_flush(struct terminal *term)
+{
+	struct iovec iov[2];
+	ssize_t n;
+
+	while (term->out.len) {
+		iov[0].iov_base = term->out.data + term->out.head;
+		iov[0].iov_len = term->out.size - term->out.head;
+		if (iov[0].iov_len > term->out.len)
+			iov[0].iov_len = term->out.len;
+		iov[1].iov_base = term->out.data;
+		iov[1].iov_len = term->out.len - iov[0].iov_len;
+
+		n = writev(term->master_fd, iov, iov[1].iov_len ? 2 : 1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				error("could not write to pty master");
+				term->out.len = 0;
+			}
+			break;
+		}
+
+		term->out.head = (term->out.head + n) & (term->out.size - 1);
+		term->out.len -= n;
+	}
+
+	if (term->out.len == 0)
+		term->out.head = 0;
+}
+
+/* any of the terminals may be touched, so all of them are locked */
 static void handle_display(int ev)
 {
+	struct terminal *term;
+	int ret;
+
 	if (ev & POLLHUP) {
-		term.die = true;
+		ctx.die = true;
 	} else if (ev & POLLIN) {
-		if (wl_display_dispatch(term.display) < 0) {
+		for (term = ctx.terms; term; term = term->next)
+			pthread_mutex_lock(&term->parser.lock);
+		ret = wl_display_dispatch(ctx.display);
+		for (term = ctx.terms; term; term = term->next)
+			pthread_mutex_unlock(&term->parser.lock);
+
+		if (ret < 0) {
 			error("could not dispatch events");
 			exit(EXIT_FAILURE);
 		}
 	}
 }
 
-static void handle_tty(int ev)
+static void poke(int fd)
+{
+	if (write(fd, "", 1) < 0 && errno != EAGAIN)
+		error("could not wake thread");
+}
+
+/* called with the lock held */
+static void parser_notify(struct terminal *term)
 {
-	int len = 0;
+	if (!term->parser.notified) {
+		term->parser.notified = true;
+		poke(term->parser.notify[1]);
+	}
+}
 
-	if (ev & POLLIN) {
-		char data[256];
+static void *parser_main(void *data)
+{
+	struct terminal *term = data;
+	struct pollfd fds[2] = {
+		{ .fd = term->master_fd, .events = POLLIN },
+		{ .fd = term->parser.wake[0], .events = POLLIN },
+	};
+	char buf[4096];
+	ssize_t len;
 
-		term.need_redraw = true;
-		len = read(term.master_fd, data, sizeof(data));
+	for (;;) {
+		pthread_mutex_lock(&term->parser.lock);
+		if (term->parser.quit) {
+			pthread_mutex_unlock(&term->parser.lock);
+			break;
+		}
+		fds[0].events = term->out.len ? POLLIN | POLLOUT : POLLIN;
+		pthread_mutex_unlock(&term->parser.lock);
 
-		if (len < 0) {
-			error("could not read from pty");
-		} else {
-			tsm_vte_input(term.vte, data, len);
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			error("poll error");
+			abort();
+		}
+
+		if (fds[1].revents & POLLIN)
+			while (read(term->parser.wake[0], buf, sizeof buf) > 0)
+				;
+
+		len = 0;
+		if (fds[0].revents & POLLIN) {
+			len = read(term->master_fd, buf, sizeof buf);
+			if (len < 0 && errno != EAGAIN && errno != EINTR &&
+			    errno != EIO)
+				error("could not read from pty");
+		}
+
+		pthread_mutex_lock(&term->parser.lock);
+		if (len > 0) {
+			tsm_vte_input(term->vte, buf, len);
+			parser_notify(term);
+		}
+		if (term->out.len && fds[0].revents & (POLLIN | POLLOUT))
+			tty_flush(term);
+
+		if (fds[0].revents & (POLLHUP | POLLERR) && len <= 0) {
+			term->parser.hangup = true;
+			parser_notify(term);
+			pthread_mutex_unlock(&term->parser.lock);
+			break;
 		}
+		pthread_mutex_unlock(&term->parser.lock);
 	}
 
-	if (ev & POLLHUP && len == 0) {
-		close(term.master_fd);
-		term.master_fd = -1;
-		if (!term.opt.linger)
-			term.die = true;
+	return NULL;
+}
+
+/* none of our fds may leak into the children of other terminals */
+static int pipe_nonblock(int fd[2])
+{
+	int i;
+
+	if (pipe(fd) < 0)
+		return -1;
+
+	for (i = 0; i < 2; ++i) {
+		fcntl(fd[i], F_SETFL, O_NONBLOCK);
+		fcntl(fd[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
+
+static int parser_start(struct terminal *term)
+{
+	if (pipe_nonblock(term->parser.wake) < 0 ||
+	    pipe_nonblock(term->parser.notify) < 0)
+		return -1;
+
+	if (pthread_create(&term->parser.thread, NULL, parser_main, term))
+		return -1;
+
+	term->parser.running = true;
+	return 0;
+}
+
+static void parser_stop(struct terminal *term)
+{
+	if (term->parser.running) {
+		pthread_mutex_lock(&term->parser.lock);
+		term->parser.quit = true;
+		pthread_mutex_unlock(&term->parser.lock);
+		poke(term->parser.wake[1]);
+		pthread_join(term->parser.thread, NULL);
+		term->parser.running = false;
 	}
 }
 
@@ -277,32 +659,128 @@ static long long now(void)
 	return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
 }
 
+static void handle_tty(struct terminal *term, int ev)
+{
+	char buf[64];
+	unsigned int syncs;
+	bool hangup, sync;
+
+	if (!(ev & POLLIN))
+		return;
+
+	while (read(term->parser.notify[0], buf, sizeof buf) > 0)
+		;
+
+	pthread_mutex_lock(&term->parser.lock);
+	term->parser.notified = false;
+	term->need_redraw = true;
+	hangup = term->parser.hangup;
+	sync = tsm_screen_get_flags(term->screen) & TSM_SCREEN_SYNC;
+	syncs = tsm_screen_get_syncs(term->screen);
+	pthread_mutex_unlock(&term->parser.lock);
+
+	/* An update ended, the next one may have begun since. What it left
+	 * is drawn right away, the timer starts over with the next output. */
+	if (syncs != term->syncs) {
+		term->syncs = syncs;
+		term->sync = 0;
+	} else if (!sync) {
+		term->sync = 0;
+	} else if (!term->sync) {
+		term->sync = now();
+	}
+
+	if (hangup && term->master_fd >= 0) {
+		parser_stop(term);
+		close(term->master_fd);
+		term->master_fd = -1;
+		term->out.len = 0;
+		if (!ctx.opt.linger)
+			term->die = true;
+	}
+}
+
+/* called with the lock of the focused terminal held */
 static void handle_repeat(void)
 {
+	struct terminal *term = ctx.kbd_focus;
 	int diff;
 
-	if (term.repeat.timeout < 0)
+	if (ctx.repeat.timeout < 0 || term == NULL)
 		return;
 
-	diff = now() - term.repeat.start;
-	term.repeat.start += diff;
+	diff = now() - ctx.repeat.start;
+	ctx.repeat.start += diff;
 
-	if (diff >= term.repeat.timeout) {
-		term.repeat.timeout += term.repeat.interval - diff;
-		if (term.repeat.timeout < 0)
-			term.repeat.timeout = 0;
+	if (diff >= ctx.repeat.timeout) {
+		ctx.repeat.timeout += ctx.repeat.interval - diff;
+		if (ctx.repeat.timeout < 0)
+			ctx.repeat.timeout = 0;
 
-		if (term.repeat.action) {
-			term.repeat.action();
+		if (ctx.repeat.action) {
+			ctx.repeat.action(term);
 			return;
 		}
 
-		tsm_vte_handle_keyboard(term.vte, term.repeat.sym,
-					XKB_KEY_NoSymbol, term.mods,
-					term.repeat.unicode);
+		tsm_vte_handle_keyboard(term->vte, ctx.repeat.sym,
+					XKB_KEY_NoSymbol, ctx.mods,
+					ctx.repeat.unicode);
 	} else {
-		term.repeat.timeout -= diff;
+		ctx.repeat.timeout -= diff;
+	}
+}
+
+/* ms until a held back frame has to be drawn, -1 if none is held back */
+static int sync_timeout(struct terminal *term)
+{
+	long long left;
+
+	if (!term->sync || !term->need_redraw)
+		return -1;
+
+	left = term->sync + SYNC_TIMEOUT - now();
+	return left > 0 ? left : -1;
+}
+
+/* ms until the application has to be told the size of the grid, -1 if
+ * it knows */
+static int winch_timeout(struct terminal *term)
+{
+	long long left;
+
+	if (!term->winch)
+		return -1;
+
+	left = term->winch + WINCH_DELAY - now();
+	return left > 0 ? left : 0;
+}
+
+static void set_winsize(struct terminal *term)
+{
+	struct winsize ws = {
+		term->row, term->col, 0, 0
+	};
+
+	term->winch = 0;
+	if (term->master_fd >= 0 && ioctl(term->master_fd, TIOCSWINSZ, &ws) < 0)
+		error("could not resize pty");
+}
+
+/* poll timeout covering key repeat, held back frames and sizes */
+static int poll_timeout(void)
+{
+	struct terminal *term;
+	int timeout = ctx.repeat.timeout, sync, winch;
+
+	for (term = ctx.terms; term; term = term->next) {
+		sync = sync_timeout(term);
+		if (sync >= 0 && (timeout < 0 || sync < timeout))
+			timeout = sync;
+		winch = winch_timeout(term);
+		if (winch >= 0 && (timeout < 0 || winch < timeout))
+			timeout = winch;
 	}
+	return timeout;
 }
 
 static void cursor_draw(int frame)
@@ -310,19 +788,19 @@ static void cursor_draw(int frame)
 	struct wl_buffer *buffer;
 	struct wl_cursor_image *image;
 
-	if ((int)term.cursor.current->image_count <= frame) {
+	if ((int)ctx.cursor.current->image_count <= frame) {
 		fprintf(stderr, "cursor frame index out of range\n");
 		return;
 	}
 
-	image = term.cursor.current->images[frame];
+	image = ctx.cursor.current->images[frame];
 	buffer = wl_cursor_image_get_buffer(image);
-	wl_surface_attach(term.cursor.surface, buffer, 0, 0);
-	wl_surface_damage(term.cursor.surface, 0, 0,
+	wl_surface_attach(ctx.cursor.surface, buffer, 0, 0);
+	wl_surface_damage(ctx.cursor.surface, 0, 0,
 			  image->width, image->height);
-	wl_surface_commit(term.cursor.surface);
-	wl_pointer_set_cursor(term.ptr, term.cursor.enter_serial,
-			      term.cursor.surface,
+	wl_surface_commit(ctx.cursor.surface);
+	wl_pointer_set_cursor(ctx.ptr, ctx.cursor.enter_serial,
+			      ctx.cursor.surface,
 			      image->hotspot_x, image->hotspot_y);
 }
 
@@ -331,11 +809,11 @@ static void cursor_request_frame_callback(void);
 static void cursor_frame_callback(void *data, struct wl_callback *cb,
 				  uint32_t time)
 {
-	int frame = wl_cursor_frame(term.cursor.current,
-				    now() - term.cursor.anim_start);
+	int frame = wl_cursor_frame(ctx.cursor.current,
+				    now() - ctx.cursor.anim_start);
 
-	assert(cb == term.cursor.callback);
-	wl_callback_destroy(term.cursor.callback);
+	assert(cb == ctx.cursor.callback);
+	wl_callback_destroy(ctx.cursor.callback);
 	cursor_request_frame_callback();
 	cursor_draw(frame);
 }
@@ -346,18 +824,18 @@ static const struct wl_callback_listener cursor_frame_listener = {
 
 static void cursor_request_frame_callback(void)
 {
-	term.cursor.callback = wl_surface_frame(term.cursor.surface);
-	wl_callback_add_listener(term.cursor.callback, &cursor_frame_listener,
+	ctx.cursor.callback = wl_surface_frame(ctx.cursor.surface);
+	wl_callback_add_listener(ctx.cursor.callback, &cursor_frame_listener,
 				 NULL);
 }
 
 static void cursor_unset(void)
 {
-	if (term.cursor.callback) {
-		wl_callback_destroy(term.cursor.callback);
-		term.cursor.callback = NULL;
+	if (ctx.cursor.callback) {
+		wl_callback_destroy(ctx.cursor.callback);
+		ctx.cursor.callback = NULL;
 	}
-	term.cursor.current = NULL;
+	ctx.cursor.current = NULL;
 }
 
 static void cursor_set(struct wl_cursor *cursor)
@@ -367,24 +845,24 @@ static void cursor_set(struct wl_cursor *cursor)
 
 	cursor_unset();
 
-	if (term.ptr == NULL)
+	if (ctx.ptr == NULL)
 		return;
 
 	if (cursor == NULL)
 		goto hide;
 
-	term.cursor.current = cursor;
+	ctx.cursor.current = cursor;
 
-	frame = wl_cursor_frame_and_duration(term.cursor.current, 0, &duration);
+	frame = wl_cursor_frame_and_duration(ctx.cursor.current, 0, &duration);
 	if (duration) {
-		term.cursor.anim_start = now();
+		ctx.cursor.anim_start = now();
 		cursor_request_frame_callback();
 	}
 	cursor_draw(frame);
 
 	return;
 hide:
-	wl_pointer_set_cursor(term.ptr, term.cursor.enter_serial, NULL, 0, 0);
+	wl_pointer_set_cursor(ctx.ptr, ctx.cursor.enter_serial, NULL, 0, 0);
 }
 
 static void cursor_init(void)
@@ -403,35 +881,35 @@ static void cursor_init(void)
 			size = s;
 	}
 
-	term.cursor.theme = wl_cursor_theme_load(getenv("XCURSOR_THEME"), size,
-						 term.shm);
-	if (term.cursor.theme == NULL)
+	ctx.cursor.theme = wl_cursor_theme_load(getenv("XCURSOR_THEME"), size,
+						 ctx.shm);
+	if (ctx.cursor.theme == NULL)
 		return;
 
-	text = wl_cursor_theme_get_cursor(term.cursor.theme, "text");
+	text = wl_cursor_theme_get_cursor(ctx.cursor.theme, "text");
 	if (text == NULL)
-		text = wl_cursor_theme_get_cursor(term.cursor.theme, "ibeam");
+		text = wl_cursor_theme_get_cursor(ctx.cursor.theme, "ibeam");
 	if (text == NULL)
-		text = wl_cursor_theme_get_cursor(term.cursor.theme, "xterm");
+		text = wl_cursor_theme_get_cursor(ctx.cursor.theme, "xterm");
 
-	term.cursor.surface = wl_compositor_create_surface(term.cp);
-	if (term.cursor.surface == NULL) {
-		wl_cursor_theme_destroy(term.cursor.theme);
-		term.cursor.theme = NULL;
+	ctx.cursor.surface = wl_compositor_create_surface(ctx.cp);
+	if (ctx.cursor.surface == NULL) {
+		wl_cursor_theme_destroy(ctx.cursor.theme);
+		ctx.cursor.theme = NULL;
 		return;
 	}
 
-	term.cursor.text = text;
+	ctx.cursor.text = text;
 }
 
 static void cursor_free(void)
 {
-	if (term.cursor.callback)
-		wl_callback_destroy(term.cursor.callback);
-	if (term.cursor.surface)
-		wl_surface_destroy(term.cursor.surface);
-	if (term.cursor.theme)
-		wl_cursor_theme_destroy(term.cursor.theme);
+	if (ctx.cursor.callback)
+		wl_callback_destroy(ctx.cursor.callback);
+	if (ctx.cursor.surface)
+		wl_surface_destroy(ctx.cursor.surface);
+	if (ctx.cursor.theme)
+		wl_cursor_theme_destroy(ctx.cursor.theme);
 }
 
 #define REPLACEMENT_CHAR 0x0000fffd
@@ -484,54 +962,55 @@ static int utf8_to_utf32(char const **utf8, size_t *len, uint32_t *r)
 	return 0;
 }
 
-static void end_paste(void)
+static void end_paste(struct terminal *term)
 {
-	tsm_vte_paste_end(term.vte);
-	close(term.paste.fd[0]);
-	term.paste.fd[0] = -1;
-	term.paste.len = 0;
-	term.paste.active = false;
+	tsm_vte_paste_end(term->vte);
+	close(term->paste.fd[0]);
+	term->paste.fd[0] = -1;
+	term->paste.len = 0;
+	term->paste.active = false;
 }
 
-static void handle_paste(int ev)
+static void paste_input(struct terminal *term, int ev)
 {
 	if (ev & POLLIN) {
 		uint32_t code;
 		ssize_t len;
-		char const *p = &term.paste.buf[0];
+		char const *p = &term->paste.buf[0];
 
-		len = read(term.paste.fd[0],
-			   term.paste.buf + term.paste.len,
-			   sizeof term.paste.buf - term.paste.len);
+		len = read(term->paste.fd[0],
+			   term->paste.buf + term->paste.len,
+			   sizeof term->paste.buf - term->paste.len);
 
 		if (len <= 0) {
-			end_paste();
+			end_paste(term);
 			return;
 		}
 
-		if (term.cfg.scroll_to_bottom_on_input)
-			tsm_screen_sb_reset(term.screen);
+		if (ctx.cfg.scroll_to_bottom_on_input)
+			tsm_screen_sb_reset(term->screen);
 
-		term.need_redraw = true;
-		term.paste.len += len;
-		while (term.paste.len > 0) {
-			if (utf8_to_utf32(&p, &term.paste.len, &code)) {
-				memcpy(&term.paste.buf, p, term.paste.len);
+		term->need_redraw = true;
+		term->paste.len += len;
+		while (term->paste.len > 0) {
+			if (utf8_to_utf32(&p, &term->paste.len, &code)) {
+				memcpy(&term->paste.buf, p, term->paste.len);
 				break;
 			}
-			tsm_vte_handle_keyboard(term.vte, XKB_KEY_NoSymbol,
+			tsm_vte_handle_keyboard(term->vte, XKB_KEY_NoSymbol,
 						XKB_KEY_NoSymbol, 0, code);
 		}
 	} else if (ev & POLLHUP) {
-		end_paste();
+		end_paste(term);
 	}
 }
 
-static void (*pcb[NUM_POLLFDS])(int) = {
-	[EV_DISPLAY] = handle_display,
-	[EV_TTY] = handle_tty,
-	[EV_PASTE] = handle_paste,
-};
+static void handle_paste(struct terminal *term, int ev)
+{
+	pthread_mutex_lock(&term->parser.lock);
+	paste_input(term, ev);
+	pthread_mutex_unlock(&term->parser.lock);
+}
 
 static void buffer_release(void *data, struct wl_buffer *b)
 {
@@ -544,53 +1023,53 @@ static const struct wl_buffer_listener buffer_listener = {
 	.release = buffer_release,
 };
 
-static int buffer_init(struct buffer *buf)
+static int pool_grow(struct terminal *term, size_t size)
 {
-	struct wl_shm_pool *pool;
 	char shm_name[14];
-	int fd, stride;
-	int max = 100;
-
-	assert(!buf->busy);
-
-	stride = term.width * 4;
-	buf->size = stride * term.height;
-
-	srand(time(NULL));
-	do {
-		sprintf(shm_name, "/havoc-%d", rand() % 1000000);
-		fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
-	} while (fd < 0 && errno == EEXIST && --max);
-
-	if (fd < 0) {
-		error("shm_open failed");
-		return -1;
+	void *data;
+	int i, max = 100;
+
+	if (term->pool.fd < 0) {
+		srand(time(NULL));
+		do {
+			sprintf(shm_name, "/havoc-%d", rand() % 1000000);
+			term->pool.fd = shm_open(shm_name,
+						O_RDWR | O_CREAT | O_EXCL, 0600);
+		} while (term->pool.fd < 0 && errno == EEXIST && --max);
+
+		if (term->pool.fd < 0) {
+			error("shm_open failed");
+			return -1;
+		}
+		shm_unlink(shm_name);
 	}
-	shm_unlink(shm_name);
 
-	if (ftruncate(fd, buf->size) < 0) {
+	if (ftruncate(term->pool.fd, size) < 0) {
 		error("ftruncate failed");
-		close(fd);
 		return -1;
 	}
 
-	buf->data = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED,
-			 fd, 0);
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    term->pool.fd, 0);
 
-	if (buf->data == MAP_FAILED) {
+	if (data == MAP_FAILED) {
 		error("mmap failed");
-		close(fd);
 		return -1;
 	}
 
-	pool = wl_shm_create_pool(term.shm, fd, buf->size);
-	buf->b = wl_shm_pool_create_buffer(pool, 0, term.width, term.height,
-					   stride, WL_SHM_FORMAT_ARGB8888);
-	wl_buffer_add_listener(buf->b, &buffer_listener, buf);
-	wl_shm_pool_destroy(pool);
-	close(fd);
+	if (term->pool.pool) {
+		munmap(term->pool.data, term->pool.size);
+		wl_shm_pool_resize(term->pool.pool, size);
+	} else {
+		term->pool.pool = wl_shm_create_pool(ctx.shm, term->pool.fd,
+						    size);
+	}
 
-	buf->age = 0;
+	term->pool.data = data;
+	term->pool.size = size;
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		term->buf[i].data = (char *)data + term->buf[i].offset;
 
 	return 0;
 }
@@ -599,28 +1078,121 @@ static void buffer_unmap(struct buffer *buf)
 {
 	if (buf->b) {
 		wl_buffer_destroy(buf->b);
-		munmap(buf->data, buf->size);
+		buf->b = NULL;
 	}
+	buf->age = 0;
 }
 
-static struct buffer *swap_buffers(void)
+static int buffer_init(struct terminal *term, struct buffer *buf)
 {
-	struct buffer *buf;
+	int i, stride = term->width * 4;
+	size_t size = (size_t)stride * term->height;
+	size_t need;
 
-	assert(term.configured);
+	assert(!buf->busy);
 
-	if (!term.buf[0].busy) {
-		buf = &term.buf[0];
-	} else if (!term.buf[1].busy) {
-		buf = &term.buf[1];
-	} else {
-		fprintf(stderr, "both surface content buffers are busy\n");
+	buffer_unmap(buf);
+
+	if (size > buf->size) {
+		bool idle = true;
+
+		for (i = 0; i < NUM_BUFFERS; ++i)
+			idle = idle && !term->buf[i].busy;
+
+		/* the compositor does not look at any of our buffers, so
+		 * start carving from the beginning again */
+		if (idle) {
+			term->pool.used = 0;
+			for (i = 0; i < NUM_BUFFERS; ++i) {
+				buffer_unmap(&term->buf[i]);
+				term->buf[i].size = 0;
+			}
+		}
+
+		/* leave some room to grow into while being resized */
+		buf->offset = term->pool.used;
+		buf->size = size + size / 4;
+		need = buf->offset + buf->size;
+
+		if (need > term->pool.size &&
+		    pool_grow(term, need + need / 2) < 0) {
+			buf->size = 0;
+			return -1;
+		}
+		term->pool.used = need;
+	}
+
+	buf->data = (char *)term->pool.data + buf->offset;
+	buf->b = wl_shm_pool_create_buffer(term->pool.pool, buf->offset,
+					   term->width, term->height, stride,
+					   WL_SHM_FORMAT_ARGB8888);
+	wl_buffer_add_listener(buf->b, &buffer_listener, buf);
+
+	buf->width = term->width;
+	buf->height = term->height;
+	buf->age = 0;
+
+	return 0;
+}
+
+static void pool_destroy(struct terminal *term)
+{
+	int i;
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		buffer_unmap(&term->buf[i]);
+
+	if (term->pool.pool) {
+		wl_shm_pool_destroy(term->pool.pool);
+		munmap(term->pool.data, term->pool.size);
+	}
+
+	if (term->pool.fd >= 0)
+		close(term->pool.fd);
+}
+
+static void buffers_invalidate(struct terminal *term)
+{
+	int i;
+
+	for (i = 0; i < NUM_BUFFERS; ++i)
+		term->buf[i].age = 0;
+}
+
+/* pick the idle buffer with the most recent content, only adding another
+ * one when the compositor holds on to all we have */
+static struct buffer *swap_buffers(struct terminal *term)
+{
+	struct buffer *buf = NULL, *unused = NULL;
+	int i;
+
+	assert(term->configured);
+
+	for (i = 0; i < NUM_BUFFERS; ++i) {
+		struct buffer *b = &term->buf[i];
+
+		if (b->busy)
+			continue;
+
+		if (b->b == NULL) {
+			if (unused == NULL)
+				unused = b;
+		} else if (buf == NULL || b->age > buf->age) {
+			buf = b;
+		}
+	}
+
+	if (buf == NULL)
+		buf = unused;
+
+	if (buf == NULL) {
+		fprintf(stderr, "all surface content buffers are busy\n");
 		return NULL;
 	}
 
-	if (term.resize) {
-		buffer_unmap(buf);
-		if (buffer_init(buf) < 0)
+	if (buf->b == NULL ||
+	    buf->width != term->width || buf->height != term->height) {
+		if (buffer_init(term, buf) < 0)
 			abort();
 	}
 
@@ -633,31 +1205,32 @@ typedef uint32_t u32;
 #define mul(a, b) (((u32)(a) * (u32)(b) + 255) >> 8)
 #define join(a, r, g, b) ((u32)(a) << 24 | (u32)(r) << 16 | (u32)(g) << 8 | (u32)(b))
 
-static void blank(uint32_t *dst, int w, u8 br, u8 bg, u8 bb, u8 ba)
+static void blank(struct terminal *term, uint32_t *dst, int w,
+		  u8 br, u8 bg, u8 bb, u8 ba)
 {
 	int i;
 	uint32_t b;
-	int h = term.cheight;
+	int h = term->cheight;
 
 	b = join(ba, mul(br, ba), mul(bg, ba), mul(bb, ba));
-	w *= term.cwidth;
+	w *= term->cwidth;
 
 	while (h--) {
 		for (i = 0; i < w; ++i)
 			dst[i] = b;
-		dst += term.width;
+		dst += term->width;
 	}
 }
 
-static void print(uint32_t *dst, int w,
+static void print(struct terminal *term, uint32_t *dst, int w,
 		  u8 br, u8 bg, u8 bb,
 		  u8 fr, u8 fg, u8 fb,
 		  u8 ba, unsigned char *glyph)
 {
 	int i;
-	int h = term.cheight;
+	int h = term->cheight;
 
-	w *= term.cwidth;
+	w *= term->cwidth;
 
 	br = mul(br, ba);
 	bg = mul(bg, ba);
@@ -679,168 +1252,706 @@ static void print(uint32_t *dst, int w,
 		}
 
 		glyph += w;
-		dst += term.width;
+		dst += term->width;
 	}
 }
 
-static void draw_cell(struct tsm_screen *tsm, uint32_t id, const uint32_t *ch,
-		      size_t len, int char_width, int x, int y,
-		      const struct tsm_screen_attr *a, tsm_age_t age,
-		      void *data)
+/* Runs with the lock held, only remembers which cells need to be drawn so
+ * that the parser can go on while we render. */
+static void collect_cell(struct tsm_screen *tsm, uint64_t id,
+			 const uint32_t *ch, size_t len, int char_width,
+			 int x, int y, const struct tsm_screen_attr *a,
+			 tsm_age_t age, void *data)
 {
 	struct buffer *buffer = data;
-	uint32_t *dst = buffer->data;
+	struct dirty *d;
 
 	if (age && age <= buffer->age)
 		return;
 
-	dst += term.margin.top * term.width + term.margin.left;
-	dst = &dst[y * term.cheight * term.width + x * term.cwidth];
+	assert(ctx.dirty.len < ctx.dirty.size);
+	d = &ctx.dirty.cell[ctx.dirty.len++];
+	d->id = id;
+	d->ch = len ? ch[0] : 0;
+	d->seq = len > 1 ? ch : NULL;
+	d->len = len;
+	d->width = char_width;
+	d->x = x;
+	d->y = y;
+	d->attr = *a;
+	d->glyph = NULL;
+}
+
+static void draw_cell(struct terminal *term, struct buffer *buffer,
+		      const struct dirty *d)
+{
+	const struct tsm_screen_attr *a = &d->attr;
+	int char_width = d->width;
+	uint32_t *dst = buffer->data;
 
-	if (len == 0) {
+	dst += term->margin.top * term->width + term->margin.left;
+	dst = &dst[d->y * term->cheight * term->width + d->x * term->cwidth];
+
+	if (d->len == 0) {
 		if (a->inverse)
-			blank(dst, char_width,
-			      ~a->br, ~a->bg, ~a->bb, term.cfg.opacity);
+			blank(term, dst, char_width,
+			      ~a->br, ~a->bg, ~a->bb, ctx.cfg.opacity);
 		else
-			blank(dst, char_width,
-			      a->br, a->bg, a->bb, term.cfg.opacity);
+			blank(term, dst, char_width,
+			      a->br, a->bg, a->bb, ctx.cfg.opacity);
 	} else {
-		/* todo, combining marks */
-		unsigned char *g = get_glyph(id, ch[0], char_width);
+		unsigned char *g = d->glyph;
 
 		if (a->inverse)
-			print(dst, char_width,
+			print(term, dst, char_width,
 			      ~a->br, ~a->bg, ~a->bb,
 			      ~a->fr, ~a->fg, ~a->fb,
-			      term.cfg.opacity, g);
+			      ctx.cfg.opacity, g);
 		else
-			print(dst, char_width,
+			print(term, dst, char_width,
 			      a->br, a->bg, a->bb,
 			      a->fr, a->fg, a->fb,
-			      term.cfg.opacity, g);
+			      ctx.cfg.opacity, g);
+	}
+}
+
+static void draw_margin(struct terminal *term, struct buffer *buffer)
+{
+	uint32_t *dst = buffer->data;
+	uint8_t a = ctx.cfg.opacity;
+	uint8_t *rgb = ctx.cfg.colors[TSM_COLOR_BACKGROUND];
+	uint32_t c = join(a, mul(rgb[0], a), mul(rgb[1], a), mul(rgb[2], a));
+	int inw = term->col * term->cwidth;
+	int inh = term->row * term->cheight;
+	int i, j;
+
+	for (i = 0; i < term->width * term->margin.top; ++i)
+		dst[i] = c;
+
+	for (i = (term->margin.top + inh) * term->width;
+	     i < term->height * term->width;
+	     ++i)
+		dst[i] = c;
+
+	for (i = term->margin.top; i < term->margin.top + inh; ++i) {
+		for (j = 0; j < term->margin.left; ++j)
+			dst[i * term->width + j] = c;
+
+		for (j = term->margin.left + inw; j < term->width; ++j)
+			dst[i * term->width + j] = c;
+	}
+}
+
+static void frame_callback(void *data, struct wl_callback *cb, uint32_t time)
+{
+	struct terminal *term = data;
+
+	assert(term->cb == cb);
+	wl_callback_destroy(cb);
+	term->cb = NULL;
+	term->can_redraw = true;
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_callback,
+};
+
+static void draw_band(int band)
+{
+	int i;
+
+	for (i = ctx.render.band[band]; i < ctx.render.band[band + 1]; ++i)
+		draw_cell(ctx.render.term, ctx.render.buffer,
+			  &ctx.dirty.cell[i]);
+}
+
+/* called with the render lock held, drops it while drawing */
+static void draw_bands(void)
+{
+	int band;
+
+	while ((band = ctx.render.next) < ctx.render.bands) {
+		ctx.render.next++;
+		pthread_mutex_unlock(&ctx.render.lock);
+		draw_band(band);
+		pthread_mutex_lock(&ctx.render.lock);
+		if (--ctx.render.pending == 0)
+			pthread_cond_signal(&ctx.render.done);
+	}
+}
+
+static void *render_main(void *data)
+{
+	unsigned gen = 0;
+
+	pthread_mutex_lock(&ctx.render.lock);
+	for (;;) {
+		while (!ctx.render.quit && ctx.render.gen == gen)
+			pthread_cond_wait(&ctx.render.start,
+					  &ctx.render.lock);
+		if (ctx.render.quit)
+			break;
+		gen = ctx.render.gen;
+		draw_bands();
+	}
+	pthread_mutex_unlock(&ctx.render.lock);
+
+	return NULL;
+}
+
+static void render_start(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	ctx.render.started = true;
+
+	if (n > RENDER_THREADS_MAX)
+		n = RENDER_THREADS_MAX;
+
+	for (ctx.render.num = 0; ctx.render.num < n; ++ctx.render.num)
+		if (pthread_create(&ctx.render.thread[ctx.render.num], NULL,
+				   render_main, NULL))
+			break;
+}
+
+static void render_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&ctx.render.lock);
+	ctx.render.quit = true;
+	pthread_cond_broadcast(&ctx.render.start);
+	pthread_mutex_unlock(&ctx.render.lock);
+
+	for (i = 0; i < ctx.render.num; ++i)
+		pthread_join(ctx.render.thread[i], NULL);
+	ctx.render.num = 0;
+}
+
+static void render_cells(struct terminal *term, struct buffer *buffer)
+{
+	int i, bands, rows;
+
+	if (ctx.dirty.len < RENDER_PARALLEL_MIN) {
+		for (i = 0; i < ctx.dirty.len; ++i)
+			draw_cell(term, buffer, &ctx.dirty.cell[i]);
+		return;
+	}
+
+	if (!ctx.render.started)
+		render_start();
+
+	/* cells come in row order, so cutting the list at row boundaries
+	 * gives each band its own disjoint strip of the buffer. a couple of
+	 * bands per thread evens out rows of differing cost. */
+	bands = (ctx.render.num + 1) * 2;
+	_Static_assert(ARRAY_LENGTH(ctx.render.band) >=
+		       (RENDER_THREADS_MAX + 1) * 2 + 1,
+		       "render bands need an end entry for every thread");
+	rows = ctx.dirty.cell[ctx.dirty.len - 1].y + 1;
+	ctx.render.band[0] = 0;
+	for (i = 1; i < bands; ++i) {
+		int end = ctx.render.band[i - 1];
+		int limit = rows * i / bands;
+
+		while (end < ctx.dirty.len && ctx.dirty.cell[end].y < limit)
+			end++;
+		ctx.render.band[i] = end;
+	}
+	ctx.render.band[bands] = ctx.dirty.len;
+
+	pthread_mutex_lock(&ctx.render.lock);
+	ctx.render.term = term;
+	ctx.render.buffer = buffer;
+	ctx.render.bands = bands;
+	ctx.render.next = 0;
+	ctx.render.pending = bands;
+	ctx.render.gen++;
+	pthread_cond_broadcast(&ctx.render.start);
+
+	draw_bands();
+	while (ctx.render.pending)
+		pthread_cond_wait(&ctx.render.done, &ctx.render.lock);
+	pthread_mutex_unlock(&ctx.render.lock);
+}
+
+static int dirty_reserve(int n)
+{
+	struct dirty *cell;
+
+	if (n <= ctx.dirty.size)
+		return 0;
+
+	cell = realloc(ctx.dirty.cell, n * sizeof *cell);
+	if (cell == NULL)
+		return -1;
+
+	ctx.dirty.cell = cell;
+	ctx.dirty.size = n;
+	return 0;
+}
+
+static int rows_reserve(struct terminal *term, uint8_t **rows, int *size)
+{
+	uint8_t *r;
+
+	if (term->row <= *size)
+		return 0;
+
+	r = realloc(*rows, term->row);
+	if (r == NULL)
+		return -1;
+
+	*rows = r;
+	*size = term->row;
+	return 0;
+}
+
+static void copy_rows(struct terminal *term, struct buffer *dst, struct buffer *src,
+		      int first, int last)
+{
+	size_t off = (term->margin.top + first * term->cheight) * term->width;
+	size_t len = (last - first) * term->cheight * term->width;
+
+	memcpy((uint32_t *)dst->data + off, (uint32_t *)src->data + off,
+	       len * sizeof(uint32_t));
+}
+
+/* bring a stale buffer up to the state of the front buffer by copying the
+ * rows drawn in between, so only the latest changes need to be rendered */
+static void copy_damage(struct terminal *term, struct buffer *buf)
+{
+	struct buffer *front = term->front;
+	struct damage *d;
+	bool full = false;
+	unsigned f;
+	int y, first;
+
+	if (front == NULL || front == buf || !front->age || !buf->age ||
+	    front->width != buf->width || front->height != buf->height ||
+	    front->frame - buf->frame > DAMAGE_HISTORY)
+		return;
+
+	if (rows_reserve(term, &term->damage.rows, &term->damage.size) < 0)
+		full = true;
+	else
+		memset(term->damage.rows, 0, term->row);
+
+	for (f = buf->frame + 1; !full && f != front->frame + 1; ++f) {
+		d = &term->damage.hist[f % DAMAGE_HISTORY];
+		if (d->frame != f || d->full)
+			full = true;
+		else
+			for (y = 0; y < term->row; ++y)
+				term->damage.rows[y] |= d->rows[y];
+	}
+
+	if (full) {
+		memcpy(buf->data, front->data,
+		       (size_t)term->width * term->height * sizeof(uint32_t));
+	} else {
+		for (y = 0; y < term->row; ++y) {
+			if (!term->damage.rows[y])
+				continue;
+			for (first = y; y < term->row && term->damage.rows[y]; ++y)
+				;
+			copy_rows(term, buf, front, first, y);
+		}
+	}
+
+	buf->age = front->age;
+	buf->frame = front->frame;
+	buf->prompt |= front->prompt;
+}
+
+/* move the pixels of rows that scrolled, what scrolls in is dirty anyway */
+static void scroll_rows(struct terminal *term, struct buffer *buf, const struct tsm_screen_scroll *op)
+{
+	uint32_t *data = buf->data;
+	size_t row = (size_t)term->cheight * term->width;
+	int num = op->num < 0 ? -op->num : op->num;
+	int len = op->bottom + 1 - op->top - num;
+
+	if (len <= 0)
+		return;
+
+	data += term->margin.top * term->width;
+	if (op->num > 0)
+		memmove(data + op->top * row, data + (op->top + num) * row,
+			len * row * sizeof(uint32_t));
+	else
+		memmove(data + (op->top + num) * row, data + op->top * row,
+			len * row * sizeof(uint32_t));
+}
+
+static void damage_surface(struct terminal *term, struct damage *d)
+{
+	int y, first;
+
+	if (d->full) {
+		wl_surface_damage(term->surf, 0, 0, term->width, term->height);
+		return;
+	}
+
+	for (y = 0; y < term->row; ++y) {
+		if (!d->rows[y])
+			continue;
+		for (first = y; y < term->row && d->rows[y]; ++y)
+			;
+		wl_surface_damage(term->surf, 0,
+				  term->margin.top + first * term->cheight,
+				  term->width, (y - first) * term->cheight);
+	}
+}
+
+/* paints the search prompt over the bottom row */
+static void draw_search(struct terminal *term, struct buffer *buffer)
+{
+	static const char prompt[] = "search: ", missing[] = "  [not found]";
+	uint8_t *fg = ctx.cfg.colors[TSM_COLOR_BACKGROUND];
+	uint8_t *bg = ctx.cfg.colors[TSM_COLOR_FOREGROUND];
+	uint32_t text[ARRAY_LENGTH(prompt) + ARRAY_LENGTH(term->search.buf) +
+		      ARRAY_LENGTH(missing)];
+	struct dirty d = {
+		.y = term->row - 1,
+		.attr = {
+			.fr = fg[0], .fg = fg[1], .fb = fg[2],
+			.br = bg[0], .bg = bg[1], .bb = bg[2],
+		},
+	};
+	size_t i, n = 0;
+	int w;
+
+	for (i = 0; prompt[i]; ++i)
+		text[n++] = prompt[i];
+	for (i = 0; i < term->search.len; ++i)
+		text[n++] = term->search.buf[i];
+	for (i = 0; term->search.missing && missing[i]; ++i)
+		text[n++] = missing[i];
+
+	/* wide characters take two cells, one that would not fit in the
+	 * row is left out with everything after it */
+	for (i = 0, d.x = 0; d.x < term->col; d.x += d.width) {
+		d.ch = i < n ? text[i++] : ' ';
+		w = tsm_wcwidth(d.ch) > 1 ? 2 : 1;
+		if (d.x + w > term->col) {
+			d.ch = ' ';
+			i = n;
+		}
+		d.width = d.ch == ' ' ? 1 : w;
+		d.id = d.ch;
+		d.len = d.ch != ' ';
+		if (d.len)
+			d.glyph = get_glyph(d.id, &d.ch, 1, d.width, 0);
+		draw_cell(term, buffer, &d);
 	}
 }
 
-static void draw_margin(struct buffer *buffer)
+/* the prompt covers screen content, the bottom row has to be drawn again
+ * when it opens, changes or closes */
+static void search_dirty(struct terminal *term)
 {
-	uint32_t *dst = buffer->data;
-	uint8_t a = term.cfg.opacity;
-	uint8_t *rgb = term.cfg.colors[TSM_COLOR_BACKGROUND];
-	uint32_t c = join(a, mul(rgb[0], a), mul(rgb[1], a), mul(rgb[2], a));
-	int inw = term.col * term.cwidth;
-	int inh = term.row * term.cheight;
-	int i, j;
+	int y = tsm_screen_get_height(term->screen) - 1;
 
-	for (i = 0; i < term.width * term.margin.top; ++i)
-		dst[i] = c;
+	tsm_screen_age_rows(term->screen, y, y);
+}
 
-	for (i = (term.margin.top + inh) * term.width;
-	     i < term.height * term.width;
-	     ++i)
-		dst[i] = c;
+/* the row the prompt painted over the bottom of a buffer ends up in once
+ * the scrolls are replayed, -1 if it scrolled out of the buffer */
+static int prompt_row(struct terminal *term)
+{
+	int i, y = tsm_screen_get_height(term->screen) - 1;
 
-	for (i = term.margin.top; i < term.margin.top + inh; ++i) {
-		for (j = 0; j < term.margin.left; ++j)
-			dst[i * term.width + j] = c;
+	for (i = 0; i < ctx.scroll.len; ++i) {
+		struct tsm_screen_scroll *op = &ctx.scroll.op[i];
 
-		for (j = term.margin.left + inw; j < term.width; ++j)
-			dst[i * term.width + j] = c;
+		if (y < op->top || y > op->bottom)
+			continue;
+		y -= op->num;
+		if (y < op->top || y > op->bottom)
+			return -1;
 	}
-}
 
-static void frame_callback(void *data, struct wl_callback *cb, uint32_t time)
-{
-	assert(term.cb == cb);
-	wl_callback_destroy(cb);
-	term.cb = NULL;
-	term.can_redraw = true;
+	return y;
 }
 
-static const struct wl_callback_listener frame_listener = {
-	.done = frame_callback,
-};
+static void resize(struct terminal *term);
 
-static void redraw(void)
+static void redraw(struct terminal *term)
 {
-	struct buffer *buffer = swap_buffers();
+	struct buffer *buffer;
+	struct damage *damage;
+	bool full;
+	int i, n;
+
+	if (term->need_resize) {
+		pthread_mutex_lock(&term->parser.lock);
+		resize(term);
+		pthread_mutex_unlock(&term->parser.lock);
+	}
 
+	buffer = swap_buffers(term);
 	if (buffer == NULL) {
 		fprintf(stderr, "no buffer available, cannot redraw\n");
 		return;
 	}
 
-	wl_surface_attach(term.surf, buffer->b, 0, 0);
-	buffer->age = tsm_screen_draw(term.screen, draw_cell, buffer);
-	if (buffer->age == 0)
-		term.buf[0].age = term.buf[1].age = 0;
-	wl_surface_damage(term.surf, 0, 0, term.width, term.height);
+	/* the glyph caches are shared, the terminals may be zoomed apart */
+	font_set_size(term->font_size, &term->cwidth, &term->cheight);
 
-	term.cb = wl_surface_frame(term.surf);
-	wl_callback_add_listener(term.cb, &frame_listener, NULL);
-	wl_surface_commit(term.surf);
+	if (ctx.cfg.copy_damage)
+		copy_damage(term, buffer);
 
-	buffer->busy = true;
-	term.can_redraw = false;
-	term.need_redraw = false;
-	if (term.resize) {
-		--term.resize;
+	pthread_mutex_lock(&term->parser.lock);
+	if (dirty_reserve(tsm_screen_get_width(term->screen) *
+			  tsm_screen_get_height(term->screen)) < 0) {
+		pthread_mutex_unlock(&term->parser.lock);
+		fprintf(stderr, "out of memory, cannot redraw\n");
+		return;
+	}
+	ctx.dirty.len = 0;
+	ctx.scroll.len = 0;
+	if (buffer->age) {
+		n = tsm_screen_get_scrolls(term->screen, buffer->age,
+					   ctx.scroll.op, MAX_SCROLLS);
+		if (n < 0)
+			buffer->age = 0;
+		else
+			ctx.scroll.len = n;
+	}
+	/* scrolls may move an old prompt up into the screen, where the
+	 * content under it was never drawn in this buffer */
+	if (buffer->age && buffer->prompt) {
+		n = prompt_row(term);
+		if (n >= 0 && (n != term->row - 1 || !term->search.active))
+			tsm_screen_age_rows(term->screen, n, n);
+	}
+	full = buffer->age == 0;
+	buffer->age = tsm_screen_draw(term->screen, collect_cell, buffer);
+	pthread_mutex_unlock(&term->parser.lock);
 
-		if (term.cfg.margin)
-			draw_margin(buffer);
+	if (ctx.cfg.margin && full)
+		draw_margin(term, buffer);
+
+	for (i = 0; i < ctx.scroll.len; ++i)
+		scroll_rows(term, buffer, &ctx.scroll.op[i]);
+
+	damage = &term->damage.hist[++term->damage.frame % DAMAGE_HISTORY];
+	damage->frame = term->damage.frame;
+	damage->full = full || buffer->age == 0 ||
+		rows_reserve(term, &damage->rows, &damage->size) < 0;
+
+	if (buffer->age == 0)
+		buffers_invalidate(term);
+
+	if (!damage->full) {
+		memset(damage->rows, 0, term->row);
+		for (i = 0; i < ctx.scroll.len; ++i)
+			memset(damage->rows + ctx.scroll.op[i].top, 1,
+			       ctx.scroll.op[i].bottom + 1 -
+			       ctx.scroll.op[i].top);
+		for (i = 0; i < ctx.dirty.len; ++i)
+			damage->rows[ctx.dirty.cell[i].y] = 1;
 	}
+
+	/* the glyph cache is not thread safe, fill it before fanning out */
+	for (i = 0; i < ctx.dirty.len; ++i) {
+		struct dirty *d = &ctx.dirty.cell[i];
+
+		if (d->len)
+			d->glyph = get_glyph(d->id, d->seq ? d->seq : &d->ch,
+					     d->len, d->width,
+					     (d->attr.bold ? FACE_BOLD : 0) |
+					     (d->attr.italic ? FACE_ITALIC : 0));
+	}
+
+	render_cells(term, buffer);
+
+	if (term->search.active)
+		draw_search(term, buffer);
+	buffer->prompt = term->search.active;
+
+	wl_surface_attach(term->surf, buffer->b, 0, 0);
+	damage_surface(term, damage);
+	buffer->frame = damage->frame;
+	term->front = buffer;
+
+	term->cb = wl_surface_frame(term->surf);
+	wl_callback_add_listener(term->cb, &frame_listener, term);
+	wl_surface_commit(term->surf);
+
+	buffer->busy = true;
+	term->can_redraw = false;
+	term->need_redraw = false;
 }
 
-static void paste(bool primary)
+static void paste(struct terminal *term, bool primary)
 {
 	if (primary) {
-		if (!term.ps_dm || !term.paste.ps_mime)
+		if (!ctx.ps_dm || !ctx.paste.ps_mime)
 			return;
 	} else {
-		if (!term.d_dm || !term.paste.d_mime)
+		if (!ctx.d_dm || !ctx.paste.d_mime)
 			return;
 	}
 
-	if (term.paste.active)
-		end_paste();
+	if (term->paste.active)
+		end_paste(term);
 
-	if (pipe(term.paste.fd) < 0)
+	if (pipe(term->paste.fd) < 0)
 		return;
+	fcntl(term->paste.fd[0], F_SETFD, FD_CLOEXEC);
 
 	if (primary) {
-		zwp_primary_selection_offer_v1_receive(term.paste.ps_offer,
-						       term.paste.ps_mime,
-						       term.paste.fd[1]);
+		zwp_primary_selection_offer_v1_receive(ctx.paste.ps_offer,
+						       ctx.paste.ps_mime,
+						       term->paste.fd[1]);
 	} else {
-		wl_data_offer_receive(term.paste.d_offer, term.paste.d_mime,
-				      term.paste.fd[1]);
+		wl_data_offer_receive(ctx.paste.d_offer, ctx.paste.d_mime,
+				      term->paste.fd[1]);
 	}
-	close(term.paste.fd[1]);
+	close(term->paste.fd[1]);
 
-	term.paste.active = true;
-	tsm_vte_paste_begin(term.vte);
+	term->paste.active = true;
+	tsm_vte_paste_begin(term->vte);
 }
 
-static void action_paste(void)
+static void action_paste(struct terminal *term)
 {
-	paste(false);
+	paste(term, false);
 }
 
 static void ds_target(void *d, struct wl_data_source *ds, const char *mt)
 {
 }
 
+/* The selection is written from the main loop as the receiver reads it,
+ * encoded piece by piece so large ones never sit in memory as a whole.
+ * Runs with the parser lock of @term held. */
+static void send_selection(struct terminal *term,
+			   struct tsm_screen_selection_reader *sel, int fd)
+{
+	struct send *t;
+
+	if (ctx.num_sends == MAX_SENDS) {
+		fprintf(stderr, "too many clipboard transfers\n");
+		close(fd);
+		return;
+	}
+
+	t = &ctx.send[ctx.num_sends];
+	if (tsm_screen_selection_reader_dup(sel, &t->sel) < 0) {
+		close(fd);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	t->fd = fd;
+	t->term = term;
+	t->len = 0;
+	t->off = 0;
+	++ctx.num_sends;
+}
+
+/* false once the transfer is over, one way or another */
+static bool send_more(struct send *t, int ev)
+{
+	size_t sent = 0;
+	ssize_t n;
+
+	if (ev & (POLLERR | POLLHUP | POLLNVAL))
+		return false;
+
+	if (!(ev & POLLOUT))
+		return true;
+
+	while (sent < SEND_BURST) {
+		if (t->off == t->len) {
+			t->len = tsm_screen_selection_read(t->term->screen,
+							   t->sel, t->buf,
+							   sizeof(t->buf));
+			t->off = 0;
+			if (t->len == 0)
+				return false;
+		}
+
+		n = write(t->fd, t->buf + t->off, t->len - t->off);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR;
+
+		t->off += n;
+		sent += n;
+	}
+
+	return true;
+}
+
+/* @pfd has the events of the first @num transfers, later ones were
+ * started after polling */
+static void handle_sends(struct pollfd *pfd, int num)
+{
+	bool more;
+	int i, j;
+
+	for (i = 0, j = 0; i < ctx.num_sends; ++i) {
+		struct send *t = &ctx.send[i];
+
+		if (i < num) {
+			pthread_mutex_lock(&t->term->parser.lock);
+			more = send_more(t, pfd[i].revents);
+			pthread_mutex_unlock(&t->term->parser.lock);
+
+			if (!more) {
+				tsm_screen_selection_reader_free(t->sel);
+				close(t->fd);
+				continue;
+			}
+		}
+
+		if (i != j)
+			ctx.send[j] = *t;
+		++j;
+	}
+	ctx.num_sends = j;
+}
+
+/* the transfers of a terminal go away with it */
+static void drop_sends(struct terminal *term)
+{
+	int i, j;
+
+	for (i = 0, j = 0; i < ctx.num_sends; ++i) {
+		struct send *t = &ctx.send[i];
+
+		if (t->term == term) {
+			tsm_screen_selection_reader_free(t->sel);
+			close(t->fd);
+			continue;
+		}
+
+		if (i != j)
+			ctx.send[j] = *t;
+		++j;
+	}
+	ctx.num_sends = j;
+}
+
 static void ds_send(void *data, struct wl_data_source *ds,
 		    const char *mime_type, int32_t fd)
 {
-	write(fd, term.d_copy.data, strlen(term.d_copy.data));
-	close(fd);
+	struct terminal *term = data;
+
+	send_selection(term, term->d_copy.sel, fd);
 }
 
 static void ds_cancelled(void *data, struct wl_data_source *source)
 {
-	wl_data_source_destroy(term.d_copy.source);
-	term.d_copy.source = NULL;
-	free(term.d_copy.data);
+	struct terminal *term = data;
+
+	wl_data_source_destroy(term->d_copy.source);
+	term->d_copy.source = NULL;
+	tsm_screen_selection_reader_free(term->d_copy.sel);
+	term->d_copy.sel = NULL;
 }
 
 static void ds_dnd_drop_performed(void *data, struct wl_data_source *ds)
@@ -864,44 +1975,45 @@ static struct wl_data_source_listener ds_listener = {
 	.action = ds_action,
 };
 
-static void d_copy(uint32_t serial)
+static void d_copy(struct terminal *term, uint32_t serial)
 {
-	if (!term.d_dm)
+	if (!ctx.d_dm)
 		return;
 
-	if (tsm_screen_selection_copy(term.screen, &term.d_copy.data) < 0)
+	if (tsm_screen_selection_reader_new(term->screen,
+					    &term->d_copy.sel) < 0)
 		return;
 
-	term.d_copy.source =
-		wl_data_device_manager_create_data_source(term.d_dm);
-	wl_data_source_offer(term.d_copy.source, "UTF8_STRING");
-	wl_data_source_offer(term.d_copy.source, "text/plain");
-	wl_data_source_add_listener(term.d_copy.source, &ds_listener, NULL);
-	wl_data_device_set_selection(term.d_d, term.d_copy.source, serial);
+	term->d_copy.source =
+		wl_data_device_manager_create_data_source(ctx.d_dm);
+	wl_data_source_offer(term->d_copy.source, "UTF8_STRING");
+	wl_data_source_offer(term->d_copy.source, "text/plain");
+	wl_data_source_add_listener(term->d_copy.source, &ds_listener, term);
+	wl_data_device_set_selection(ctx.d_d, term->d_copy.source, serial);
 }
 
-static void d_uncopy(void)
+static void d_uncopy(struct terminal *term)
 {
-	if (!term.d_dm)
+	if (!ctx.d_dm)
 		return;
 
-	if (!term.d_copy.source)
+	if (!term->d_copy.source)
 		return;
 
-	ds_cancelled(NULL, term.d_copy.source);
+	ds_cancelled(term, term->d_copy.source);
 }
 
 static uint32_t action_copy_serial;
-static void action_copy(void)
+static void action_copy(struct terminal *term)
 {
-	d_uncopy();
-	if (term.selection == SS_ACTIVE)
-		d_copy(action_copy_serial);
+	d_uncopy(term);
+	if (term->selection == SS_ACTIVE)
+		d_copy(term, action_copy_serial);
 }
 
 static void reset_repeat(void)
 {
-	term.repeat.timeout = -1;
+	ctx.repeat.timeout = -1;
 }
 
 static void setup_compose(void)
@@ -910,11 +2022,17 @@ static void setup_compose(void)
 	struct xkb_compose_state *compose_state;
 	char *lang = getenv("LANG");
 
+	/* the table only depends on the locale */
+	if (ctx.xkb_compose_state) {
+		xkb_compose_state_reset(ctx.xkb_compose_state);
+		return;
+	}
+
 	if (lang == NULL)
 		return;
 
 	compose_table =
-		xkb_compose_table_new_from_locale(term.xkb_ctx,
+		xkb_compose_table_new_from_locale(ctx.xkb_ctx,
 						  lang,
 						  XKB_COMPOSE_COMPILE_NO_FLAGS);
 	if (!compose_table) {
@@ -932,10 +2050,10 @@ static void setup_compose(void)
 		return;
 	}
 
-	xkb_compose_table_unref(term.xkb_compose_table);
-	xkb_compose_state_unref(term.xkb_compose_state);
-	term.xkb_compose_table = compose_table;
-	term.xkb_compose_state = compose_state;
+	xkb_compose_table_unref(ctx.xkb_compose_table);
+	xkb_compose_state_unref(ctx.xkb_compose_state);
+	ctx.xkb_compose_table = compose_table;
+	ctx.xkb_compose_state = compose_state;
 }
 
 static void kbd_keymap(void *data, struct wl_keyboard *k, uint32_t fmt,
@@ -956,7 +2074,7 @@ static void kbd_keymap(void *data, struct wl_keyboard *k, uint32_t fmt,
 		return;
 	}
 
-	keymap = xkb_keymap_new_from_string(term.xkb_ctx, map,
+	keymap = xkb_keymap_new_from_string(ctx.xkb_ctx, map,
 					    XKB_KEYMAP_FORMAT_TEXT_V1,
 					    XKB_KEYMAP_COMPILE_NO_FLAGS);
 	munmap(map, size);
@@ -974,42 +2092,44 @@ static void kbd_keymap(void *data, struct wl_keyboard *k, uint32_t fmt,
 		return;
 	}
 
-	xkb_keymap_unref(term.xkb_keymap);
-	xkb_state_unref(term.xkb_state);
-	term.xkb_keymap = keymap;
-	term.xkb_state = state;
+	xkb_keymap_unref(ctx.xkb_keymap);
+	xkb_state_unref(ctx.xkb_state);
+	ctx.xkb_keymap = keymap;
+	ctx.xkb_state = state;
 
 	setup_compose();
 
-	term.xkb_ctrl = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_CTRL);
-	term.xkb_alt = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_ALT);
-	term.xkb_shift = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_SHIFT);
+	ctx.xkb_ctrl = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_CTRL);
+	ctx.xkb_alt = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_ALT);
+	ctx.xkb_shift = xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_SHIFT);
 }
 
 static void kbd_enter(void *data, struct wl_keyboard *k, uint32_t serial,
 		      struct wl_surface *surf, struct wl_array *keys)
 {
+	ctx.kbd_focus = surf ? wl_surface_get_user_data(surf) : NULL;
 }
 
 static void kbd_leave(void *data, struct wl_keyboard *k, uint32_t serial,
 		      struct wl_surface *surf)
 {
+	ctx.kbd_focus = NULL;
 	reset_repeat();
 }
 
 static xkb_keysym_t compose(xkb_keysym_t sym)
 {
-	if (!term.xkb_compose_state)
+	if (!ctx.xkb_compose_state)
 		return sym;
 	if (sym == XKB_KEY_NoSymbol)
 		return sym;
-	if (xkb_compose_state_feed(term.xkb_compose_state,
+	if (xkb_compose_state_feed(ctx.xkb_compose_state,
 				   sym) != XKB_COMPOSE_FEED_ACCEPTED)
 		return sym;
 
-	switch (xkb_compose_state_get_status(term.xkb_compose_state)) {
+	switch (xkb_compose_state_get_status(ctx.xkb_compose_state)) {
 	case XKB_COMPOSE_COMPOSED:
-		return xkb_compose_state_get_one_sym(term.xkb_compose_state);
+		return xkb_compose_state_get_one_sym(ctx.xkb_compose_state);
 	case XKB_COMPOSE_COMPOSING:
 	case XKB_COMPOSE_CANCELLED:
 		return XKB_KEY_NoSymbol;
@@ -1019,26 +2139,74 @@ static xkb_keysym_t compose(xkb_keysym_t sym)
 	}
 }
 
+/* runs the query after every edit, Return looks for the next older match,
+ * Shift+Return the next newer one */
+static void search_key(struct terminal *term, xkb_keysym_t sym,
+		       uint32_t unicode)
+{
+	bool up = true;
+
+	if (sym == XKB_KEY_Escape) {
+		term->search.active = false;
+		tsm_screen_search_reset(term->screen);
+		search_dirty(term);
+		term->need_redraw = true;
+		return;
+	} else if (sym == XKB_KEY_Return || sym == XKB_KEY_KP_Enter) {
+		up = !(ctx.mods & TSM_SHIFT_MASK);
+	} else if (sym == XKB_KEY_BackSpace) {
+		if (term->search.len == 0)
+			return;
+		--term->search.len;
+		tsm_screen_search_reset(term->screen);
+	} else {
+		if (unicode == TSM_VTE_INVALID || unicode < 0x20 ||
+		    unicode == 0x7f || tsm_wcwidth(unicode) < 1 ||
+		    ctx.mods & (TSM_CONTROL_MASK | TSM_ALT_MASK) ||
+		    term->search.len == ARRAY_LENGTH(term->search.buf))
+			return;
+		term->search.buf[term->search.len++] = unicode;
+		tsm_screen_search_reset(term->screen);
+	}
+
+	search_dirty(term);
+	term->search.missing = false;
+	if (term->search.len)
+		term->search.missing = tsm_screen_search(term->screen,
+							term->search.buf,
+							term->search.len,
+							up) < 0;
+	else
+		tsm_screen_selection_reset(term->screen);
+	term->need_redraw = true;
+}
+
+static void search_repeat(struct terminal *term)
+{
+	search_key(term, ctx.repeat.sym, ctx.repeat.unicode);
+}
+
 static void kbd_key(void *data, struct wl_keyboard *k, uint32_t serial,
 		    uint32_t time, uint32_t key, uint32_t state)
 {
 	xkb_keysym_t sym, lsym;
 	uint32_t unicode;
+	struct terminal *term = ctx.kbd_focus;
 	struct binding *b;
-	void (*action)(void) = NULL;
+	void (*action)(struct terminal *) = NULL;
 
-	if (!term.xkb_keymap || !term.xkb_state)
+	if (!ctx.xkb_keymap || !ctx.xkb_state || term == NULL)
 		return;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED) {
-		if (term.repeat.key == key)
+		if (ctx.repeat.key == key)
 			reset_repeat();
 		return;
 	}
 
 	cursor_set(NULL);
 
-	sym = compose(xkb_state_key_get_one_sym(term.xkb_state, key + 8));
+	sym = compose(xkb_state_key_get_one_sym(ctx.xkb_state, key + 8));
 
 	unicode = xkb_keysym_to_utf32(sym);
 	if (unicode == 0)
@@ -1046,31 +2214,34 @@ static void kbd_key(void *data, struct wl_keyboard *k, uint32_t serial,
 
 	lsym = xkb_keysym_to_lower(sym);
 	action_copy_serial = serial;
-	b = term.binding;
+	b = term->search.active ? NULL : ctx.binding;
 	while (b) {
-		if (term.mods == b->mods && lsym == b->sym) {
-			b->action();
+		if (ctx.mods == b->mods && lsym == b->sym) {
+			b->action(term);
 			action = b->action;
 			break;
 		}
 		b = b->next;
 	}
 
-	if (!action) {
-		if (tsm_vte_handle_keyboard(term.vte, sym, XKB_KEY_NoSymbol,
-					    term.mods, unicode) &&
-		    term.cfg.scroll_to_bottom_on_input &&
-		    tsm_screen_sb_reset(term.screen))
-			term.need_redraw = true;
+	if (!action && term->search.active) {
+		search_key(term, sym, unicode);
+		action = search_repeat;
+	} else if (!action) {
+		if (tsm_vte_handle_keyboard(term->vte, sym, XKB_KEY_NoSymbol,
+					    ctx.mods, unicode) &&
+		    ctx.cfg.scroll_to_bottom_on_input &&
+		    tsm_screen_sb_reset(term->screen))
+			term->need_redraw = true;
 	}
 
-	if (xkb_keymap_key_repeats(term.xkb_keymap, key + 8)) {
-		term.repeat.key = key;
-		term.repeat.sym = sym;
-		term.repeat.unicode = unicode;
-		term.repeat.action = action;
-		term.repeat.timeout = term.repeat.delay;
-		term.repeat.start = now();
+	if (xkb_keymap_key_repeats(ctx.xkb_keymap, key + 8)) {
+		ctx.repeat.key = key;
+		ctx.repeat.sym = sym;
+		ctx.repeat.unicode = unicode;
+		ctx.repeat.action = action;
+		ctx.repeat.timeout = ctx.repeat.delay;
+		ctx.repeat.start = now();
 	}
 }
 
@@ -1078,22 +2249,22 @@ static void kbd_mods(void *data, struct wl_keyboard *k, uint32_t serial,
 		     uint32_t depressed, uint32_t latched, uint32_t locked,
 		     uint32_t group)
 {
-	if (!term.xkb_keymap || !term.xkb_state)
+	if (!ctx.xkb_keymap || !ctx.xkb_state)
 		return;
 
-	xkb_state_update_mask(term.xkb_state, depressed, latched, locked,
+	xkb_state_update_mask(ctx.xkb_state, depressed, latched, locked,
 			      0, 0, group);
 
-	term.mods = 0;
-	if (xkb_state_mod_index_is_active(term.xkb_state, term.xkb_alt,
+	ctx.mods = 0;
+	if (xkb_state_mod_index_is_active(ctx.xkb_state, ctx.xkb_alt,
 					  XKB_STATE_MODS_EFFECTIVE) == 1)
-		term.mods |= TSM_ALT_MASK;
-	if (xkb_state_mod_index_is_active(term.xkb_state, term.xkb_ctrl,
+		ctx.mods |= TSM_ALT_MASK;
+	if (xkb_state_mod_index_is_active(ctx.xkb_state, ctx.xkb_ctrl,
 					  XKB_STATE_MODS_EFFECTIVE) == 1)
-		term.mods |= TSM_CONTROL_MASK;
-	if (xkb_state_mod_index_is_active(term.xkb_state, term.xkb_shift,
+		ctx.mods |= TSM_CONTROL_MASK;
+	if (xkb_state_mod_index_is_active(ctx.xkb_state, ctx.xkb_shift,
 					  XKB_STATE_MODS_EFFECTIVE) == 1)
-		term.mods |= TSM_SHIFT_MASK;
+		ctx.mods |= TSM_SHIFT_MASK;
 
 	reset_repeat();
 }
@@ -1104,8 +2275,8 @@ static void kbd_repeat(void *data, struct wl_keyboard *k,
 	if (rate > 1000)
 		rate = 1000;
 
-	term.repeat.interval = rate > 0 ? 1000 / rate : -1;
-	term.repeat.delay = rate > 0 ? delay : -1;
+	ctx.repeat.interval = rate > 0 ? 1000 / rate : -1;
+	ctx.repeat.delay = rate > 0 ? delay : -1;
 }
 
 static struct wl_keyboard_listener kbd_listener = {
@@ -1122,16 +2293,20 @@ static void pss_send(void *data,
 		     const char *mime_type,
 		     int32_t fd)
 {
-	write(fd, term.ps_copy.data, strlen(term.ps_copy.data));
-	close(fd);
+	struct terminal *term = data;
+
+	send_selection(term, term->ps_copy.sel, fd);
 }
 
 static void pss_cancelled(void *data,
 			  struct zwp_primary_selection_source_v1 *source)
 {
-	zwp_primary_selection_source_v1_destroy(term.ps_copy.source);
-	term.ps_copy.source = NULL;
-	free(term.ps_copy.data);
+	struct terminal *term = data;
+
+	zwp_primary_selection_source_v1_destroy(term->ps_copy.source);
+	term->ps_copy.source = NULL;
+	tsm_screen_selection_reader_free(term->ps_copy.sel);
+	term->ps_copy.sel = NULL;
 }
 
 static struct zwp_primary_selection_source_v1_listener pss_listener = {
@@ -1140,180 +2315,197 @@ static struct zwp_primary_selection_source_v1_listener pss_listener = {
 };
 
 
-static void ps_copy(uint32_t serial)
+static void ps_copy(struct terminal *term, uint32_t serial)
 {
-	if (!term.ps_dm)
+	if (!ctx.ps_dm)
 		return;
 
-	if (tsm_screen_selection_copy(term.screen, &term.ps_copy.data) < 0)
+	if (tsm_screen_selection_reader_new(term->screen,
+					    &term->ps_copy.sel) < 0)
 		return;
 
-	term.ps_copy.source =
-		zwp_primary_selection_device_manager_v1_create_source(term.ps_dm);
-	zwp_primary_selection_source_v1_offer(term.ps_copy.source, "UTF8_STRING");
-	zwp_primary_selection_source_v1_offer(term.ps_copy.source, "text/plain");
-	zwp_primary_selection_source_v1_add_listener(term.ps_copy.source,
-						     &pss_listener, NULL);
-	zwp_primary_selection_device_v1_set_selection(term.ps_d,
-						      term.ps_copy.source,
+	term->ps_copy.source =
+		zwp_primary_selection_device_manager_v1_create_source(ctx.ps_dm);
+	zwp_primary_selection_source_v1_offer(term->ps_copy.source, "UTF8_STRING");
+	zwp_primary_selection_source_v1_offer(term->ps_copy.source, "text/plain");
+	zwp_primary_selection_source_v1_add_listener(term->ps_copy.source,
+						     &pss_listener, term);
+	zwp_primary_selection_device_v1_set_selection(ctx.ps_d,
+						      term->ps_copy.source,
 						      serial);
 }
 
-static void ps_uncopy(void)
+static void ps_uncopy(struct terminal *term)
 {
-	if (!term.ps_dm)
+	if (!ctx.ps_dm)
 		return;
 
-	if (!term.ps_copy.source)
+	if (!term->ps_copy.source)
 		return;
 
-	pss_cancelled(NULL, term.ps_copy.source);
+	pss_cancelled(term, term->ps_copy.source);
 }
 
-static inline int grid_x(void)
+static inline int grid_x(struct terminal *term)
 {
-	int x = (wl_fixed_to_double(term.ptr_x) - term.margin.left) / term.cwidth;
+	int x = (wl_fixed_to_double(ctx.ptr_x) - term->margin.left) / term->cwidth;
 
 	if (x < 0)
 		return 0;
 
-	if (x >= term.col)
-		return term.col - 1;
+	if (x >= term->col)
+		return term->col - 1;
 
 	return x;
 }
 
-static inline int grid_y(void)
+static inline int grid_y(struct terminal *term)
 {
-	int y = (wl_fixed_to_double(term.ptr_y) - term.margin.top) / term.cheight;
+	int y = (wl_fixed_to_double(ctx.ptr_y) - term->margin.top) / term->cheight;
 
 	if (y < 0)
 		return 0;
 
-	if (y >= term.row)
-		return term.row - 1;
+	if (y >= term->row)
+		return term->row - 1;
 
 	return y;
 }
 
-static void selection_start(enum tsm_screen_selection_mode mode)
+static void selection_start(struct terminal *term,
+			    enum tsm_screen_selection_mode mode)
 {
-	tsm_screen_selection_start(term.screen, mode, grid_x(), grid_y());
+	tsm_screen_selection_start(term->screen, mode, grid_x(term),
+				   grid_y(term));
 }
 
 static void ptr_enter(void *data, struct wl_pointer *wl_pointer,
 		      uint32_t serial, struct wl_surface *surface,
 		      wl_fixed_t x, wl_fixed_t y)
 {
-	term.ptr_x = x;
-	term.ptr_y = y;
+	ctx.ptr_focus = surface ? wl_surface_get_user_data(surface) : NULL;
+	ctx.ptr_x = x;
+	ctx.ptr_y = y;
 
-	term.cursor.enter_serial = serial;
-	cursor_set(term.cursor.text);
+	ctx.cursor.enter_serial = serial;
+	cursor_set(ctx.cursor.text);
 }
 
 static void ptr_leave(void *data, struct wl_pointer *wl_pointer,
 		      uint32_t serial, struct wl_surface *surface)
 {
+	ctx.ptr_focus = NULL;
 	cursor_unset();
 }
 
 static void ptr_motion(void *data, struct wl_pointer *wl_pointer,
 		       uint32_t time, wl_fixed_t x, wl_fixed_t y)
 {
-	term.ptr_x = x;
-	term.ptr_y = y;
+	struct terminal *term = ctx.ptr_focus;
+
+	ctx.ptr_x = x;
+	ctx.ptr_y = y;
+
+	if (term == NULL)
+		return;
 
-	switch (term.selection) {
+	switch (term->selection) {
 	case SS_ANCHORED:
-		ps_uncopy();
-		term.selection = SS_DRAGGING;
-		selection_start(TSM_SM_CHAR);
-		term.need_redraw = true;
+		ps_uncopy(term);
+		term->selection = SS_DRAGGING;
+		selection_start(term, TSM_SM_CHAR);
+		term->need_redraw = true;
 		break;
 	case SS_DRAGGING:
-		tsm_screen_selection_target(term.screen, grid_x(), grid_y());
-		term.need_redraw = true;
+		tsm_screen_selection_target(term->screen, grid_x(term),
+					    grid_y(term));
+		term->need_redraw = true;
 		break;
 	case SS_RESET:
 	case SS_ACTIVE:
 		break;
 	}
 
-	if (term.cursor.current == NULL && term.cursor.text)
-		cursor_set(term.cursor.text);
+	if (ctx.cursor.current == NULL && ctx.cursor.text)
+		cursor_set(ctx.cursor.text);
 }
 
 static void ptr_button(void *data, struct wl_pointer *wl_pointer,
 		       uint32_t serial, uint32_t time, uint32_t button,
 		       uint32_t state)
 {
+	struct terminal *term = ctx.ptr_focus;
+
+	if (term == NULL)
+		return;
+
 	if (button == 0x110) {
 		switch (state) {
 		case WL_POINTER_BUTTON_STATE_PRESSED:
-			if (term.selection == SS_ACTIVE) {
-				tsm_screen_selection_reset(term.screen);
-				term.need_redraw = true;
+			if (term->selection == SS_ACTIVE) {
+				tsm_screen_selection_reset(term->screen);
+				term->need_redraw = true;
 			}
-			term.selection = SS_ANCHORED;
+			term->selection = SS_ANCHORED;
 
-			if (term.click.count > 0
-			    && term.click.x == grid_x()
-			    && term.click.y == grid_y()) {
-				++term.click.count;
+			if (term->click.count > 0
+			    && term->click.x == grid_x(term)
+			    && term->click.y == grid_y(term)) {
+				++term->click.count;
 			} else {
-				term.click.count = 1;
-				term.click.x = grid_x();
-				term.click.y = grid_y();
+				term->click.count = 1;
+				term->click.x = grid_x(term);
+				term->click.y = grid_y(term);
 			}
 
-			if (term.click.count >= 2) {
-				ps_uncopy();
-				if (term.click.count == 2) {
-					selection_start(TSM_SM_WORD);
+			if (term->click.count >= 2) {
+				ps_uncopy(term);
+				if (term->click.count == 2) {
+					selection_start(term, TSM_SM_WORD);
 				}
-				if (term.click.count == 3) {
-					selection_start(TSM_SM_LINE);
-					term.click.count = 0;
+				if (term->click.count == 3) {
+					selection_start(term, TSM_SM_LINE);
+					term->click.count = 0;
 				}
-				term.selection = SS_DRAGGING;
-				term.need_redraw = true;
+				term->selection = SS_DRAGGING;
+				term->need_redraw = true;
 			}
 			break;
 		case WL_POINTER_BUTTON_STATE_RELEASED:
-			if (term.selection == SS_ANCHORED) {
-				term.selection = SS_RESET;
+			if (term->selection == SS_ANCHORED) {
+				term->selection = SS_RESET;
 			}
 
-			if (term.selection == SS_DRAGGING) {
-				ps_copy(serial);
-				tsm_screen_selection_finish(term.screen);
-				term.selection = SS_ACTIVE;
+			if (term->selection == SS_DRAGGING) {
+				ps_copy(term, serial);
+				tsm_screen_selection_finish(term->screen);
+				term->selection = SS_ACTIVE;
 			}
 		}
 	} else if (button == 0x112 &&
 		   state == WL_POINTER_BUTTON_STATE_RELEASED) {
-		paste(true);
+		paste(term, true);
 	}
 
-	if (term.cursor.current == NULL && term.cursor.text)
-		cursor_set(term.cursor.text);
+	if (ctx.cursor.current == NULL && ctx.cursor.text)
+		cursor_set(ctx.cursor.text);
 }
 
 static void ptr_axis(void *data, struct wl_pointer *wl_pointer,
 		     uint32_t time, uint32_t axis, wl_fixed_t value)
 {
+	struct terminal *term = ctx.ptr_focus;
 	int v = wl_fixed_to_double(value) / 3;
 
-	if (axis != WL_POINTER_AXIS_VERTICAL_SCROLL)
+	if (axis != WL_POINTER_AXIS_VERTICAL_SCROLL || term == NULL)
 		return;
 
 	if (v > 0)
-		tsm_screen_sb_down(term.screen, v);
+		tsm_screen_sb_down(term->screen, v);
 	else
-		tsm_screen_sb_up(term.screen, -v);
+		tsm_screen_sb_up(term->screen, -v);
 
-	term.need_redraw = true;
+	term->need_redraw = true;
 }
 
 static void ptr_frame(void *data, struct wl_pointer *wl_pointer)
@@ -1349,20 +2541,20 @@ static struct wl_pointer_listener ptr_listener = {
 
 static void seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
 {
-	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !term.kbd) {
-		term.kbd = wl_seat_get_keyboard(seat);
-		wl_keyboard_add_listener(term.kbd, &kbd_listener, NULL);
-	} else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && term.kbd) {
-		wl_keyboard_release(term.kbd);
-		term.kbd = NULL;
+	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !ctx.kbd) {
+		ctx.kbd = wl_seat_get_keyboard(seat);
+		wl_keyboard_add_listener(ctx.kbd, &kbd_listener, NULL);
+	} else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && ctx.kbd) {
+		wl_keyboard_release(ctx.kbd);
+		ctx.kbd = NULL;
 	}
 
-	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !term.ptr) {
-		term.ptr = wl_seat_get_pointer(term.seat);
-		wl_pointer_add_listener(term.ptr, &ptr_listener, NULL);
-	} else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && term.ptr) {
-		wl_pointer_release(term.ptr);
-		term.ptr = NULL;
+	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !ctx.ptr) {
+		ctx.ptr = wl_seat_get_pointer(ctx.seat);
+		wl_pointer_add_listener(ctx.ptr, &ptr_listener, NULL);
+	} else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && ctx.ptr) {
+		wl_pointer_release(ctx.ptr);
+		ctx.ptr = NULL;
 		cursor_unset();
 	}
 }
@@ -1379,10 +2571,10 @@ static const struct wl_seat_listener seat_listener = {
 static void do_offer(void *d, struct wl_data_offer *o, const char *mime_type)
 {
 	if (strcmp(mime_type, "UTF8_STRING") == 0)
-		term.paste.d_mime = "UTF8_STRING";
-	else if(term.paste.d_mime == NULL &&
+		ctx.paste.d_mime = "UTF8_STRING";
+	else if(ctx.paste.d_mime == NULL &&
 		strcmp(mime_type, "text/plain") == 0)
-		term.paste.d_mime = "text/plain";
+		ctx.paste.d_mime = "text/plain";
 }
 
 static void do_source_actions(void *d, struct wl_data_offer *o, uint32_t sa)
@@ -1402,10 +2594,10 @@ static const struct wl_data_offer_listener do_listener = {
 static void dd_data_offer(void *data, struct wl_data_device *wl_data_device,
 			  struct wl_data_offer *offer)
 {
-	if (term.paste.d_offer)
-		wl_data_offer_destroy(term.paste.d_offer);
-	term.paste.d_offer = offer;
-	term.paste.d_mime = NULL;
+	if (ctx.paste.d_offer)
+		wl_data_offer_destroy(ctx.paste.d_offer);
+	ctx.paste.d_offer = offer;
+	ctx.paste.d_mime = NULL;
 	wl_data_offer_add_listener(offer, &do_listener, NULL);
 }
 
@@ -1431,10 +2623,10 @@ static void dd_drop(void *data, struct wl_data_device *wl_data_device)
 static void dd_selection(void *data, struct wl_data_device *wl_data_device,
 			 struct wl_data_offer *id)
 {
-	if (id == NULL && term.paste.d_offer) {
-		wl_data_offer_destroy(term.paste.d_offer);
-		term.paste.d_offer = NULL;
-		term.paste.d_mime = NULL;
+	if (id == NULL && ctx.paste.d_offer) {
+		wl_data_offer_destroy(ctx.paste.d_offer);
+		ctx.paste.d_offer = NULL;
+		ctx.paste.d_mime = NULL;
 	}
 }
 
@@ -1452,10 +2644,10 @@ static void pso_offer(void *data,
 		      const char *mime_type)
 {
 	if (strcmp(mime_type, "UTF8_STRING") == 0)
-		term.paste.ps_mime = "UTF8_STRING";
-	else if(term.paste.ps_mime == NULL &&
+		ctx.paste.ps_mime = "UTF8_STRING";
+	else if(ctx.paste.ps_mime == NULL &&
 		strcmp(mime_type, "text/plain") == 0)
-		term.paste.ps_mime = "text/plain";
+		ctx.paste.ps_mime = "text/plain";
 }
 
 static const struct zwp_primary_selection_offer_v1_listener pso_listener = {
@@ -1466,10 +2658,10 @@ static void psd_data_offer(void *data,
 			   struct zwp_primary_selection_device_v1 *ps_d,
 			   struct zwp_primary_selection_offer_v1 *offer)
 {
-	if (term.paste.ps_offer)
-		zwp_primary_selection_offer_v1_destroy(term.paste.ps_offer);
-	term.paste.ps_offer = offer;
-	term.paste.ps_mime = NULL;
+	if (ctx.paste.ps_offer)
+		zwp_primary_selection_offer_v1_destroy(ctx.paste.ps_offer);
+	ctx.paste.ps_offer = offer;
+	ctx.paste.ps_mime = NULL;
 	zwp_primary_selection_offer_v1_add_listener(offer, &pso_listener, NULL);
 }
 
@@ -1477,10 +2669,10 @@ static void psd_selection(void *data,
 			  struct zwp_primary_selection_device_v1 *ps_d,
 			  struct zwp_primary_selection_offer_v1 *id)
 {
-	if (id == NULL && term.paste.ps_offer) {
-		zwp_primary_selection_offer_v1_destroy(term.paste.ps_offer);
-		term.paste.ps_offer = NULL;
-		term.paste.ps_mime = NULL;
+	if (id == NULL && ctx.paste.ps_offer) {
+		zwp_primary_selection_offer_v1_destroy(ctx.paste.ps_offer);
+		ctx.paste.ps_offer = NULL;
+		ctx.paste.ps_mime = NULL;
 	}
 }
 
@@ -1493,14 +2685,18 @@ static void toplvl_configure(void *data, struct xdg_toplevel *xdg_toplevel,
 			     int32_t width, int32_t height,
 			     struct wl_array *state)
 {
-	term.configured = false;
-	term.confwidth = width ? width : term.cfg.col * term.cwidth;
-	term.confheight = height ? height : term.cfg.row * term.cheight;
+	struct terminal *term = data;
+
+	term->configured = false;
+	term->confwidth = width ? width : ctx.cfg.col * term->cwidth;
+	term->confheight = height ? height : ctx.cfg.row * term->cheight;
 }
 
 static void toplvl_close(void *data, struct xdg_toplevel *t)
 {
-	term.die = true;
+	struct terminal *term = data;
+
+	term->die = true;
 }
 
 static const struct xdg_toplevel_listener toplvl_listener = {
@@ -1508,47 +2704,65 @@ static const struct xdg_toplevel_listener toplvl_listener = {
 	.close = toplvl_close,
 };
 
-static void configure(void *d, struct xdg_surface *surf, uint32_t serial)
+/* Fits the grid into the window after either of them changed size, once
+ * per frame however many configures came in. The application is told
+ * when the size settles, it redraws everything each time. */
+static void resize(struct terminal *term)
 {
-	xdg_surface_ack_configure(surf, serial);
-	int col = term.confwidth / term.cwidth;
-	int row = term.confheight / term.cheight;
-	struct winsize ws = {
-		row, col, 0, 0
-	};
-
-	assert(!term.configured);
-	term.configured = true;
+	int col = term->confwidth / term->cwidth;
+	int row = term->confheight / term->cheight;
+	int width = term->width, height = term->height;
+	int left = term->margin.left, top = term->margin.top;
+	bool first = term->col == 0;
 
+	term->need_resize = false;
 	if (col == 0 || row == 0)
 		return;
 
-	if (term.width == term.confwidth && term.height == term.confheight)
-		return;
-
-	if (term.cfg.margin) {
-		term.width = term.confwidth;
-		term.height = term.confheight;
-		term.margin.left = (term.width - col * term.cwidth) / 2;
-		term.margin.top = (term.height - row * term.cheight) / 2;
-		term.need_redraw = true;
-		term.resize = 2;
+	if (ctx.cfg.margin) {
+		term->width = term->confwidth;
+		term->height = term->confheight;
+		term->margin.left = (term->width - col * term->cwidth) / 2;
+		term->margin.top = (term->height - row * term->cheight) / 2;
 	} else {
-		term.width = col * term.cwidth;
-		term.height = row * term.cheight;
+		term->width = col * term->cwidth;
+		term->height = row * term->cheight;
+	}
+
+	if (term->width != width || term->height != height ||
+	    term->margin.left != left || term->margin.top != top) {
+		term->need_redraw = true;
+		buffers_invalidate(term);
 	}
 
-	if (term.col == col && term.row == row)
+	if (term->col == col && term->row == row)
 		return;
 
-	term.col = col;
-	term.row = row;
-	tsm_screen_resize(term.screen, col, row);
-	if (term.master_fd >= 0 && ioctl(term.master_fd, TIOCSWINSZ, &ws) < 0)
-		error("could not resize pty");
+	term->col = col;
+	term->row = row;
+	tsm_screen_resize(term->screen, col, row);
+
+	/* the application starts out without a size, then hears of it once
+	 * it settles */
+	term->winch = now();
+	if (first)
+		set_winsize(term);
+
+	term->need_redraw = true;
+	buffers_invalidate(term);
+}
+
+static void configure(void *data, struct xdg_surface *surf, uint32_t serial)
+{
+	struct terminal *term = data;
+
+	xdg_surface_ack_configure(surf, serial);
+
+	assert(!term->configured);
+	term->configured = true;
 
-	term.need_redraw = true;
-	term.resize = 2;
+	term->need_resize = true;
+	term->need_redraw = true;
 }
 
 static const struct xdg_surface_listener surf_listener = {
@@ -1567,7 +2781,7 @@ static const struct xdg_wm_base_listener wm_base_listener = {
 static void shm_format(void *data, struct wl_shm *shm, uint32_t format)
 {
 	if (format == WL_SHM_FORMAT_ARGB8888)
-		term.shm_argb = true;
+		ctx.shm_argb = true;
 }
 
 static const struct wl_shm_listener shm_listener = {
@@ -1578,41 +2792,41 @@ static void registry_get(void *data, struct wl_registry *r, uint32_t id,
 			 const char *i, uint32_t version)
 {
 	if (strcmp(i, "wl_compositor") == 0) {
-		term.cp = wl_registry_bind(r, id, &wl_compositor_interface, 1);
+		ctx.cp = wl_registry_bind(r, id, &wl_compositor_interface, 1);
 	} else if (strcmp(i, "wl_shm") == 0) {
-		term.shm = wl_registry_bind(r, id, &wl_shm_interface, 1);
-		wl_shm_add_listener(term.shm, &shm_listener, NULL);
+		ctx.shm = wl_registry_bind(r, id, &wl_shm_interface, 1);
+		wl_shm_add_listener(ctx.shm, &shm_listener, NULL);
 	} else if (strcmp(i, "xdg_wm_base") == 0) {
-		term.wm_base = wl_registry_bind(r, id, &xdg_wm_base_interface,
+		ctx.wm_base = wl_registry_bind(r, id, &xdg_wm_base_interface,
 						1);
-		xdg_wm_base_add_listener(term.wm_base, &wm_base_listener, NULL);
+		xdg_wm_base_add_listener(ctx.wm_base, &wm_base_listener, NULL);
 	} else if (strcmp(i, "wl_seat") == 0) {
-		term.seat = wl_registry_bind(r, id, &wl_seat_interface, 5);
-		wl_seat_add_listener(term.seat, &seat_listener, NULL);
+		ctx.seat = wl_registry_bind(r, id, &wl_seat_interface, 5);
+		wl_seat_add_listener(ctx.seat, &seat_listener, NULL);
 	} else if (strcmp(i, "wl_data_device_manager") == 0) {
-		term.d_dm = wl_registry_bind(r, id,
+		ctx.d_dm = wl_registry_bind(r, id,
 			&wl_data_device_manager_interface, 2);
 	} else if (strcmp(i, "zwp_primary_selection_device_manager_v1") == 0) {
-		term.ps_dm = wl_registry_bind(r, id,
+		ctx.ps_dm = wl_registry_bind(r, id,
 			&zwp_primary_selection_device_manager_v1_interface, 1);
 	} else if (strcmp(i, "zxdg_decoration_manager_v1") == 0) {
-		term.deco.manager = wl_registry_bind(r, id,
+		ctx.deco_manager = wl_registry_bind(r, id,
 			&zxdg_decoration_manager_v1_interface, 1);
 	}
 }
 
-static void setup_deco(void)
+static void setup_deco(struct terminal *term)
 {
-	if (term.deco.manager) {
-		term.deco.deco =
+	if (ctx.deco_manager) {
+		term->deco =
 			zxdg_decoration_manager_v1_get_toplevel_decoration(
-				term.deco.manager, term.toplvl);
+				ctx.deco_manager, term->toplvl);
 
-		if (term.cfg.decorations == DECO_AUTO)
-			zxdg_toplevel_decoration_v1_unset_mode(term.deco.deco);
+		if (ctx.cfg.decorations == DECO_AUTO)
+			zxdg_toplevel_decoration_v1_unset_mode(term->deco);
 		else
-			zxdg_toplevel_decoration_v1_set_mode(term.deco.deco,
-				term.cfg.decorations == DECO_NONE
+			zxdg_toplevel_decoration_v1_set_mode(term->deco,
+				ctx.cfg.decorations == DECO_NONE
 				? ZXDG_TOPLEVEL_DECORATION_V1_MODE_CLIENT_SIDE
 				: ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
 	}
@@ -1627,22 +2841,28 @@ static const struct wl_registry_listener reg_listener = {
 	.global_remove = registry_loose,
 };
 
-static void setup_pty(char *argv[])
+/* runs @argv, or the shell if empty, in @cwd unless it is NULL */
+static int setup_pty(struct terminal *term, char *argv[], const char *cwd)
 {
-	pid_t pid = forkpty(&term.master_fd, NULL, NULL, NULL);
+	pid_t pid = forkpty(&term->master_fd, NULL, NULL, NULL);
 
 	if (pid < 0) {
 		error("forkpty failed");
-		exit(EXIT_FAILURE);
+		return -1;
 	} else if (pid == 0) {
 		char *prog;
+		signal(SIGPIPE, SIG_DFL);
+		signal(SIGCHLD, SIG_DFL);
 		setenv("TERM", "xterm-256color", 1);
+		if (cwd && chdir(cwd) < 0)
+			fprintf(stderr, "could not change to %s: %s\n", cwd,
+				strerror(errno));
 		if (*argv) {
 			execvp(*argv, argv);
 			prog = *argv;
 		} else {
-			execlp(term.cfg.shell, term.cfg.shell, (char *) NULL);
-			prog = term.cfg.shell;
+			execlp(ctx.cfg.shell, ctx.cfg.shell, (char *) NULL);
+			prog = ctx.cfg.shell;
 		}
 		fprintf(stderr, "could not execute %s: %s\n", prog,
 			strerror(errno));
@@ -1653,60 +2873,289 @@ static void setup_pty(char *argv[])
 		pause();
 		exit(EXIT_FAILURE);
 	}
-	fcntl(term.master_fd, F_SETFL, O_NONBLOCK);
+	fcntl(term->master_fd, F_SETFL, O_NONBLOCK);
+	fcntl(term->master_fd, F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
+/* room for the fixed pollfds, those of @num terminals, the transfers and
+ * the clients */
+static int pollfds_reserve(int num)
+{
+	struct pollfd *pfd;
+	size_t n = NUM_POLLFDS + TERM_POLLFDS * num + MAX_SENDS + MAX_CLIENTS;
+
+	pfd = realloc(ctx.pollfds, n * sizeof(*pfd));
+	if (pfd == NULL)
+		return -1;
+
+	ctx.pollfds = pfd;
+	return 0;
+}
+
+/* takes down a window that is not or no longer in the list */
+static void term_free(struct terminal *term)
+{
+	int i;
+
+	if (ctx.kbd_focus == term) {
+		ctx.kbd_focus = NULL;
+		reset_repeat();
+	}
+	if (ctx.ptr_focus == term)
+		ctx.ptr_focus = NULL;
+	drop_sends(term);
+
+	parser_stop(term);
+	if (term->master_fd >= 0)
+		close(term->master_fd);
+	if (term->paste.fd[0] >= 0)
+		close(term->paste.fd[0]);
+	for (i = 0; i < 2; ++i) {
+		if (term->parser.wake[i] >= 0)
+			close(term->parser.wake[i]);
+		if (term->parser.notify[i] >= 0)
+			close(term->parser.notify[i]);
+	}
+
+	d_uncopy(term);
+	ps_uncopy(term);
+
+	pool_destroy(term);
+	for (i = 0; i < DAMAGE_HISTORY; ++i)
+		free(term->damage.hist[i].rows);
+	free(term->damage.rows);
+	if (term->cb)
+		wl_callback_destroy(term->cb);
+
+	if (term->deco)
+		zxdg_toplevel_decoration_v1_destroy(term->deco);
+	if (term->toplvl)
+		xdg_toplevel_destroy(term->toplvl);
+	if (term->xdgsurf)
+		xdg_surface_destroy(term->xdgsurf);
+	if (term->surf)
+		wl_surface_destroy(term->surf);
+
+	free(term->out.data);
+	if (term->vte)
+		tsm_vte_unref(term->vte);
+	if (term->screen)
+		tsm_screen_unref(term->screen);
+	pthread_mutex_destroy(&term->parser.lock);
+	free(term);
+}
+
+#define fail(s) { fprintf(stderr, s "\n"); goto fail; }
+
+/* opens a window running @argv in @cwd, see setup_pty */
+static struct terminal *term_new(char *argv[], const char *cwd)
+{
+	struct terminal *term = calloc(1, sizeof(*term));
+
+	if (term == NULL)
+		return NULL;
+
+	pthread_mutex_init(&term->parser.lock, NULL);
+	term->master_fd = -1;
+	term->pool.fd = -1;
+	term->paste.fd[0] = -1;
+	term->parser.wake[0] = term->parser.wake[1] = -1;
+	term->parser.notify[0] = term->parser.notify[1] = -1;
+
+	if (pollfds_reserve(ctx.num_terms + 1) < 0)
+		fail("out of memory");
+
+	term->font_size = ctx.cfg.font_size;
+	font_set_size(term->font_size, &term->cwidth, &term->cheight);
+
+	if (setup_pty(term, argv, cwd) < 0)
+		goto fail;
+
+	if (tsm_screen_new(&term->screen) < 0)
+		fail("failed to create tsm screen");
+	tsm_screen_set_max_sb(term->screen, ctx.cfg.scrollback);
+
+	if (tsm_vte_new(&term->vte, term->screen, wcb, term) < 0)
+		fail("failed to create tsm vte");
+	tsm_vte_set_palette(term->vte, ctx.cfg.colors);
+
+	if (parser_start(term) < 0)
+		fail("could not start parser thread");
+
+	term->surf = wl_compositor_create_surface(ctx.cp);
+	if (term->surf == NULL)
+		fail("could not create surface");
+	/* input events name the surface, this finds the terminal */
+	wl_surface_set_user_data(term->surf, term);
+
+	term->xdgsurf = xdg_wm_base_get_xdg_surface(ctx.wm_base, term->surf);
+	if (term->xdgsurf == NULL)
+		fail("could not create xdg_surface");
+	xdg_surface_add_listener(term->xdgsurf, &surf_listener, term);
+
+	term->toplvl = xdg_surface_get_toplevel(term->xdgsurf);
+	if (term->toplvl == NULL)
+		fail("could not create xdg_toplevel");
+	xdg_toplevel_add_listener(term->toplvl, &toplvl_listener, term);
+	xdg_toplevel_set_title(term->toplvl, "havoc");
+	xdg_toplevel_set_app_id(term->toplvl, ctx.opt.app_id);
+
+	setup_deco(term);
+
+	wl_surface_commit(term->surf);
+	term->can_redraw = true;
+
+	term->next = ctx.terms;
+	ctx.terms = term;
+	++ctx.num_terms;
+	return term;
+
+fail:
+	term_free(term);
+	return NULL;
+}
+
+#undef fail
+
+/* Clients of the server ask for windows, they get their answer once the
+ * window is open. The pollfds of the first @num clients start at @first,
+ * later ones came in after polling. Opening a window moves the pollfds. */
+static void handle_clients(size_t first, int num)
+{
+	char **argv, *cwd;
+	int i, j, n;
+
+	for (i = 0, j = 0; i < ctx.num_clients; ++i) {
+		struct request *r = ctx.client[i];
+
+		if (i < num && ctx.pollfds[first + i].revents) {
+			n = server_read(r, &argv, &cwd);
+			if (n > 0 && term_new(argv, cwd) == NULL) {
+				fprintf(stderr, "could not open window\n");
+				n = -1;
+			}
+			if (n != 0) {
+				server_done(r, n > 0);
+				continue;
+			}
+		}
+
+		ctx.client[j++] = r;
+	}
+	ctx.num_clients = j;
+}
+
+/* new clients of the server, the one waiting longest makes way if there
+ * are too many */
+static void handle_listen(int ev)
+{
+	struct request *r;
+
+	if (!(ev & POLLIN))
+		return;
+
+	while ((r = server_accept(ctx.listen_fd))) {
+		if (ctx.num_clients == MAX_CLIENTS) {
+			server_done(ctx.client[0], false);
+			memmove(ctx.client, ctx.client + 1,
+				--ctx.num_clients * sizeof(*ctx.client));
+		}
+		ctx.client[ctx.num_clients++] = r;
+	}
+}
+
+static void action_reset(struct terminal *term)
+{
+	tsm_vte_reset(term->vte);
+}
+
+static void action_hard_reset(struct terminal *term)
+{
+	tsm_vte_hard_reset(term->vte);
+	term->need_redraw = true;
+}
+
+static void action_scroll_up(struct terminal *term)
+{
+	tsm_screen_sb_up(term->screen, 1);
+	term->need_redraw = true;
 }
 
-static void action_reset(void)
+static void action_scroll_down(struct terminal *term)
 {
-	tsm_vte_reset(term.vte);
+	tsm_screen_sb_down(term->screen, 1);
+	term->need_redraw = true;
 }
 
-static void action_hard_reset(void)
+static void action_scroll_up_page(struct terminal *term)
 {
-	tsm_vte_hard_reset(term.vte);
-	term.need_redraw = true;
+	tsm_screen_sb_page_up(term->screen, 1);
+	term->need_redraw = true;
 }
 
-static void action_scroll_up(void)
+static void action_scroll_down_page(struct terminal *term)
 {
-	tsm_screen_sb_up(term.screen, 1);
-	term.need_redraw = true;
+	tsm_screen_sb_page_down(term->screen, 1);
+	term->need_redraw = true;
 }
 
-static void action_scroll_down(void)
+static void action_scroll_to_top(struct terminal *term)
 {
-	tsm_screen_sb_down(term.screen, 1);
-	term.need_redraw = true;
+	tsm_screen_sb_up(term->screen, ctx.cfg.scrollback);
+	term->need_redraw = true;
 }
 
-static void action_scroll_up_page(void)
+static void action_scroll_to_bottom(struct terminal *term)
 {
-	tsm_screen_sb_page_up(term.screen, 1);
-	term.need_redraw = true;
+	tsm_screen_sb_reset(term->screen);
+	term->need_redraw = true;
 }
 
-static void action_scroll_down_page(void)
+/* the window keeps its size, the grid is fitted to the new cells */
+static void zoom(struct terminal *term, int size)
 {
-	tsm_screen_sb_page_down(term.screen, 1);
-	term.need_redraw = true;
+	if (size < 6 || size > 300 || size == term->font_size)
+		return;
+
+	term->font_size = size;
+	font_set_size(size, &term->cwidth, &term->cheight);
+
+	/* every cell changes, even if the grid does not */
+	term->need_redraw = true;
+	term->need_resize = true;
+	buffers_invalidate(term);
+}
+
+static void action_zoom_in(struct terminal *term)
+{
+	zoom(term, term->font_size + 1);
+}
+
+static void action_zoom_out(struct terminal *term)
+{
+	zoom(term, term->font_size - 1);
 }
 
-static void action_scroll_to_top(void)
+static void action_zoom_reset(struct terminal *term)
 {
-	tsm_screen_sb_up(term.screen, term.cfg.scrollback);
-	term.need_redraw = true;
+	zoom(term, ctx.cfg.font_size);
 }
 
-static void action_scroll_to_bottom(void)
+static void action_search(struct terminal *term)
 {
-	tsm_screen_sb_reset(term.screen);
-	term.need_redraw = true;
+	term->search.active = true;
+	term->search.missing = false;
+	term->search.len = 0;
+	tsm_screen_search_reset(term->screen);
+	search_dirty(term);
+	term->need_redraw = true;
 }
 
 
 static struct {
 	char *name;
-	void (*f)(void);
+	void (*f)(struct terminal *);
 } actions[] = {
 	{ "copy", &action_copy },
 	{ "paste", &action_paste },
@@ -1718,6 +3167,10 @@ static struct {
 	{ "scroll down page", &action_scroll_down_page },
 	{ "scroll to top", &action_scroll_to_top },
 	{ "scroll to bottom", &action_scroll_to_bottom },
+	{ "zoom in", &action_zoom_in },
+	{ "zoom out", &action_zoom_out },
+	{ "zoom reset", &action_zoom_reset },
+	{ "search", &action_search },
 };
 
 #define CONF_FILE "havoc.cfg"
@@ -1734,39 +3187,61 @@ static long long cfg_num(const char *nptr, int base,
 static void child_config(char *key, char *val)
 {
 	if (strcmp(key, "program") == 0)
-		strncpy(term.cfg.shell, val, sizeof(term.cfg.shell) - 1);
+		strncpy(ctx.cfg.shell, val, sizeof(ctx.cfg.shell) - 1);
 }
 
 static void window_config(char *key, char *val)
 {
 	if (strcmp(key, "opacity") == 0)
-		term.cfg.opacity = cfg_num(val, 10, 0, 255);
+		ctx.cfg.opacity = cfg_num(val, 10, 0, 255);
 	else if (strcmp(key, "margin") == 0)
-		term.cfg.margin = strcmp(val, "yes") == 0;
+		ctx.cfg.margin = strcmp(val, "yes") == 0;
+	else if (strcmp(key, "copy damage") == 0)
+		ctx.cfg.copy_damage = strcmp(val, "yes") == 0;
 	else if (strcmp(key, "decorations") == 0)
-		term.cfg.decorations = strcmp(val, "yes") == 0 ? DECO_SERVER
+		ctx.cfg.decorations = strcmp(val, "yes") == 0 ? DECO_SERVER
 			: (strcmp(val, "no") == 0 ? DECO_NONE : DECO_AUTO);
 }
 
 static void terminal_config(char *key, char *val)
 {
 	if (strcmp(key, "rows") == 0)
-		term.cfg.row = cfg_num(val, 10, 1, 1000);
+		ctx.cfg.row = cfg_num(val, 10, 1, 1000);
 	else if (strcmp(key, "columns") == 0)
-		term.cfg.col = cfg_num(val, 10, 1, 1000);
+		ctx.cfg.col = cfg_num(val, 10, 1, 1000);
 	else if (strcmp(key, "scrollback") == 0)
-		term.cfg.scrollback = cfg_num(val, 10, 0, INT_MAX);
+		ctx.cfg.scrollback = cfg_num(val, 10, 0, INT_MAX);
 	else if (strcmp(key, "scroll to bottom on input") == 0)
-		term.cfg.scroll_to_bottom_on_input = strcmp(val, "yes") == 0;
+		ctx.cfg.scroll_to_bottom_on_input = strcmp(val, "yes") == 0;
+}
+
+static float cfg_float(const char *nptr, float min, float max)
+{
+	float n;
+
+	n = strtof(nptr, NULL);
+	return n < min ? min : n > max ? max : n;
 }
 
 static void font_config(char *key, char *val)
 {
 	if (strcmp(key, "size") == 0)
-		term.cfg.font_size = cfg_num(val, 10, 6, 300);
+		ctx.cfg.font_size = cfg_num(val, 10, 6, 300);
 	else if (strcmp(key, "path") == 0)
-		strncpy(term.cfg.font_path, val,
-			sizeof(term.cfg.font_path) - 1);
+		strncpy(ctx.cfg.font_path, val,
+			sizeof(ctx.cfg.font_path) - 1);
+	else if (strcmp(key, "fallback") == 0)
+		font_add_fallback(val);
+	else if (strcmp(key, "bold") == 0)
+		font_set_face(FACE_BOLD, val);
+	else if (strcmp(key, "italic") == 0)
+		font_set_face(FACE_ITALIC, val);
+	else if (strcmp(key, "bold italic") == 0)
+		font_set_face(FACE_BOLD | FACE_ITALIC, val);
+	else if (strcmp(key, "gamma") == 0)
+		ctx.cfg.gamma = cfg_float(val, 0.1f, 10.0f);
+	else if (strcmp(key, "contrast") == 0)
+		ctx.cfg.contrast = cfg_float(val, -1.0f, 1.0f);
 }
 
 static void bind_config(char *key, char *val)
@@ -1810,15 +3285,15 @@ static void bind_config(char *key, char *val)
 		if (strcmp(val, actions[i].name) == 0)
 			b->action = actions[i].f;
 	}
-	b->next = term.binding;
-	term.binding = b;
+	b->next = ctx.binding;
+	ctx.binding = b;
 }
 
 static void set_color(enum tsm_vte_color field, uint32_t val)
 {
-	term.cfg.colors[field][2] = val;
-	term.cfg.colors[field][1] = val >> 8;
-	term.cfg.colors[field][0] = val >> 16;
+	ctx.cfg.colors[field][2] = val;
+	ctx.cfg.colors[field][1] = val >> 8;
+	ctx.cfg.colors[field][0] = val >> 16;
 }
 
 static void color_config(char *key, char *val)
@@ -1846,15 +3321,15 @@ static FILE *open_config(void)
 	char path[512];
 	FILE *f;
 
-	if (term.opt.config) {
-		if (*term.opt.config == '\0')
+	if (ctx.opt.config) {
+		if (*ctx.opt.config == '\0')
 			return NULL;
 
-		f = fopen(term.opt.config, "r");
+		f = fopen(ctx.opt.config, "r");
 		if (f == NULL)
 			fprintf(stderr, "could not open '%s': %s, "
 				"using default configuration\n",
-				term.opt.config, strerror(errno));
+				ctx.opt.config, strerror(errno));
 		return f;
 	}
 
@@ -1967,6 +3442,9 @@ static void usage(void)
 	       "  -l         Keep window open after the child process exits.\n"
 	       "  -s <name>  Wayland display server to connect to.\n"
 	       "  -i <id>    Wayland app ID to use instead of \"havoc\".\n"
+	       "  --server   Open windows for clients, sharing what was"
+			     " loaded.\n"
+	       "  --client   Ask the server for a window running program.\n"
 	       "  -v         Show version information.\n"
 	       "  -h         Show this help.\n");
 }
@@ -1978,23 +3456,33 @@ static void usage(void)
 
 int main(int argc, char *argv[])
 {
-	int n, i, ret = 1;
+	int n, i, w, h, sends, clients, ret = 1;
+	size_t first_client;
+	struct terminal *term, **link;
+	struct pollfd *pfd;
 	struct binding *b;
 
 	while (++argv, *argv && **argv == '-') {
+		if (strcmp(*argv, "--server") == 0) {
+			ctx.opt.server = true;
+			continue;
+		} else if (strcmp(*argv, "--client") == 0) {
+			ctx.opt.client = true;
+			continue;
+		}
 retry:
 		switch (*++*argv) {
 		case 'c':
-			term.opt.config = take("config file path");
+			ctx.opt.config = take("config file path");
 			break;
 		case 'l':
-			term.opt.linger = true;
+			ctx.opt.linger = true;
 			break;
 		case 's':
-			term.opt.display = take("display name or socket");
+			ctx.opt.display = take("display name or socket");
 			break;
 		case 'i':
-			term.opt.app_id = take("wayland app id");
+			ctx.opt.app_id = take("wayland app id");
 			break;
 		case 'v':
 			printf("havoc " VERSION "\n");
@@ -2010,185 +3498,218 @@ retry:
 			exit(EXIT_FAILURE);
 		}
 	}
+	if (ctx.opt.client)
+		return client_main(argv);
+
 	read_config();
-	setup_pty(argv);
+	/* receivers of the clipboard may hang up on us, children of closed
+	 * windows are not waited for */
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGCHLD, SIG_IGN);
 
 #define fail(e, s) { fprintf(stderr, s "\n"); goto e; }
 
-	if (font_init(term.cfg.font_size, term.cfg.font_path,
-		      &term.cwidth, &term.cheight) < 0)
+	font_set_coverage(ctx.cfg.gamma, ctx.cfg.contrast);
+	if (font_init(ctx.cfg.font_size, ctx.cfg.font_path, &w, &h) < 0)
 		fail(efont, "could not load font");
 
-	term.xkb_ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	if (term.xkb_ctx == NULL)
+	ctx.xkb_ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+	if (ctx.xkb_ctx == NULL)
 		fail(exkb, "failed to create xkb context");
 
-	term.display = wl_display_connect(term.opt.display);
-	if (term.display == NULL)
+	/* windows of the server come up with the common glyphs ready */
+	if (ctx.opt.server) {
+		uint32_t c;
+
+		for (c = ' '; c < 0x7f; ++c)
+			get_glyph(c, &c, 1, 1, 0);
+
+		ctx.listen_fd = server_listen();
+	}
+
+	ctx.display = wl_display_connect(ctx.opt.display);
+	if (ctx.display == NULL)
 		fail(econnect, "could not connect to display");
 
-	term.registry = wl_display_get_registry(term.display);
-	wl_registry_add_listener(term.registry, &reg_listener, NULL);
+	ctx.registry = wl_display_get_registry(ctx.display);
+	wl_registry_add_listener(ctx.registry, &reg_listener, NULL);
 
-	wl_display_roundtrip(term.display);
-	if (!term.cp || !term.shm)
+	wl_display_roundtrip(ctx.display);
+	if (!ctx.cp || !ctx.shm)
 		fail(eglobals, "missing required globals");
-	if (!term.wm_base)
+	if (!ctx.wm_base)
 		fail(eglobals, "your compositor does not support xdg_wm_base,"
 			       " make sure you have the latest version");
 
-	wl_display_roundtrip(term.display);
-	if (term.shm_argb == false)
+	wl_display_roundtrip(ctx.display);
+	if (ctx.shm_argb == false)
 		fail(eglobals, "missing required ARGB8888 shm format");
 
 	cursor_init();
 
-	if (tsm_screen_new(&term.screen) < 0)
-		fail(etsm, "failed to create tsm screen");
-	tsm_screen_set_max_sb(term.screen, term.cfg.scrollback);
-
-	if (tsm_vte_new(&term.vte, term.screen, wcb, NULL) < 0)
-		fail(evte, "failed to create tsm vte");
-	tsm_vte_set_palette(term.vte, term.cfg.colors);
-
-	term.surf = wl_compositor_create_surface(term.cp);
-	if (term.surf == NULL)
-		fail(esurf, "could not create surface");
+	ctx.repeat.interval = -1;
+	ctx.repeat.delay = -1;
+	ctx.repeat.timeout = -1;
 
-	term.xdgsurf = xdg_wm_base_get_xdg_surface(term.wm_base, term.surf);
-	if (term.xdgsurf == NULL)
-		fail(exdgsurf, "could not create xdg_surface");
-	xdg_surface_add_listener(term.xdgsurf, &surf_listener, NULL);
-
-	term.toplvl = xdg_surface_get_toplevel(term.xdgsurf);
-	if (term.toplvl == NULL)
-		fail(etoplvl, "could not create xdg_toplevel");
-	xdg_toplevel_add_listener(term.toplvl, &toplvl_listener, NULL);
-	xdg_toplevel_set_title(term.toplvl, "havoc");
-	xdg_toplevel_set_app_id(term.toplvl, term.opt.app_id);
-
-	setup_deco();
-
-	wl_surface_commit(term.surf);
-	term.can_redraw = true;
-
-	term.repeat.interval = -1;
-	term.repeat.delay = -1;
-	term.repeat.timeout = -1;
-
-	if (term.d_dm && term.seat) {
-		term.d_d = wl_data_device_manager_get_data_device(
-			term.d_dm, term.seat);
-		wl_data_device_add_listener(term.d_d, &dd_listener, NULL);
+	if (ctx.d_dm && ctx.seat) {
+		ctx.d_d = wl_data_device_manager_get_data_device(
+			ctx.d_dm, ctx.seat);
+		wl_data_device_add_listener(ctx.d_d, &dd_listener, NULL);
 	}
 
-	if (term.ps_dm && term.seat) {
-		term.ps_d = zwp_primary_selection_device_manager_v1_get_device(
-			term.ps_dm, term.seat);
-		zwp_primary_selection_device_v1_add_listener(term.ps_d,
+	if (ctx.ps_dm && ctx.seat) {
+		ctx.ps_d = zwp_primary_selection_device_manager_v1_get_device(
+			ctx.ps_dm, ctx.seat);
+		zwp_primary_selection_device_v1_add_listener(ctx.ps_d,
 							     &psd_listener,
 							     NULL);
 	}
 
-	term.paste.fd[0] = -1;
+	if (pollfds_reserve(0) < 0)
+		fail(eterm, "out of memory");
 
-	struct pollfd pollfds[NUM_POLLFDS] = {
-		[EV_DISPLAY] = {
-			.fd = wl_display_get_fd(term.display),
-			.events = POLLIN,
-		},
-		[EV_TTY] = {
-			.fd = term.master_fd,
-			.events = POLLIN,
-		},
-		[EV_PASTE] = {
-			.fd = term.paste.fd[0],
-			.events = POLLIN,
-		},
-	};
+	if (!ctx.opt.server && term_new(argv, NULL) == NULL)
+		fail(eterm, "could not open window");
+
+	/* the server stays around without windows */
+	while (!ctx.die && (ctx.terms || ctx.opt.server)) {
+		for (term = ctx.terms; term; term = term->next) {
+			if (winch_timeout(term) == 0)
+				set_winsize(term);
+			if (term->can_redraw && term->need_redraw &&
+			    term->configured && sync_timeout(term) < 0)
+				redraw(term);
+		}
+
+		wl_display_flush(ctx.display);
 
-	while (!term.die) {
-		if (term.can_redraw && term.need_redraw && term.configured)
-			redraw();
+		ctx.pollfds[EV_DISPLAY].fd = wl_display_get_fd(ctx.display);
+		ctx.pollfds[EV_DISPLAY].events = POLLIN;
+		ctx.pollfds[EV_LISTEN].fd = ctx.listen_fd;
+		ctx.pollfds[EV_LISTEN].events = POLLIN;
 
-		wl_display_flush(term.display);
+		pfd = ctx.pollfds + NUM_POLLFDS;
+		for (term = ctx.terms; term; term = term->next) {
+			pthread_mutex_lock(&term->parser.lock);
+			if (term->out.len) {
+				tty_flush(term);
+				if (term->out.len)
+					poke(term->parser.wake[1]);
+			}
+			pfd[TERM_TTY].fd = term->parser.notify[0];
+			pfd[TERM_TTY].events = POLLIN;
+			pfd[TERM_PASTE].fd = term->out.len < OUT_HIGH
+				? term->paste.fd[0] : -1;
+			pfd[TERM_PASTE].events = POLLIN;
+			pthread_mutex_unlock(&term->parser.lock);
+			pfd += TERM_POLLFDS;
+		}
+		sends = ctx.num_sends;
+		for (i = 0; i < sends; ++i) {
+			pfd[i].fd = ctx.send[i].fd;
+			pfd[i].events = POLLOUT;
+		}
+		clients = ctx.num_clients;
+		for (i = 0; i < clients; ++i) {
+			pfd[sends + i].fd = server_fd(ctx.client[i]);
+			pfd[sends + i].events = POLLIN;
+		}
 
-		pollfds[EV_PASTE].fd = term.paste.fd[0];
-		n = poll(pollfds, NUM_POLLFDS, term.repeat.timeout);
+		n = poll(ctx.pollfds, pfd - ctx.pollfds + sends + clients,
+			 poll_timeout());
 		if (n < 0) {
 			error("poll error");
 			abort();
 		}
 
-		for (i = 0; i < NUM_POLLFDS; i++) {
-			void (*f)(int) = pcb[i];
+		handle_display(ctx.pollfds[EV_DISPLAY].revents);
 
-			f(pollfds[i].revents);
+		pfd = ctx.pollfds + NUM_POLLFDS;
+		for (term = ctx.terms; term; term = term->next) {
+			handle_tty(term, pfd[TERM_TTY].revents);
+			handle_paste(term, pfd[TERM_PASTE].revents);
+			pfd += TERM_POLLFDS;
 		}
-		handle_repeat();
+		if (sends)
+			handle_sends(pfd, sends);
+		first_client = pfd - ctx.pollfds + sends;
+
+		if (ctx.kbd_focus) {
+			pthread_mutex_lock(&ctx.kbd_focus->parser.lock);
+			handle_repeat();
+			pthread_mutex_unlock(&ctx.kbd_focus->parser.lock);
+		}
+
+		for (link = &ctx.terms; (term = *link); ) {
+			if (term->die) {
+				*link = term->next;
+				--ctx.num_terms;
+				term_free(term);
+			} else {
+				link = &term->next;
+			}
+		}
+
+		handle_clients(first_client, clients);
+		handle_listen(ctx.pollfds[EV_LISTEN].revents);
 	}
 
 	ret = 0;
 
-	buffer_unmap(&term.buf[0]);
-	buffer_unmap(&term.buf[1]);
-	if (term.cb)
-		wl_callback_destroy(term.cb);
-
-	if (term.d_d)
-		wl_data_device_release(term.d_d);
-	if (term.ps_d)
-		zwp_primary_selection_device_v1_destroy(term.ps_d);
-	if (term.ptr)
-		wl_pointer_release(term.ptr);
-	if (term.kbd)
-		wl_keyboard_release(term.kbd);
-
-	if (term.deco.deco)
-		zxdg_toplevel_decoration_v1_destroy(term.deco.deco);
-
-	if (term.deco.manager)
-		zxdg_decoration_manager_v1_destroy(term.deco.manager);
-
-	xdg_toplevel_destroy(term.toplvl);
-etoplvl:
-	xdg_surface_destroy(term.xdgsurf);
-exdgsurf:
-	wl_surface_destroy(term.surf);
-esurf:
-	tsm_vte_unref(term.vte);
-evte:
-	tsm_screen_unref(term.screen);
-etsm:
+eterm:
+	while (ctx.num_clients)
+		server_done(ctx.client[--ctx.num_clients], false);
+	while ((term = ctx.terms)) {
+		ctx.terms = term->next;
+		term_free(term);
+	}
+	render_stop();
+	free(ctx.dirty.cell);
+	free(ctx.pollfds);
+
+	if (ctx.d_d)
+		wl_data_device_release(ctx.d_d);
+	if (ctx.ps_d)
+		zwp_primary_selection_device_v1_destroy(ctx.ps_d);
+	if (ctx.ptr)
+		wl_pointer_release(ctx.ptr);
+	if (ctx.kbd)
+		wl_keyboard_release(ctx.kbd);
+
+	if (ctx.deco_manager)
+		zxdg_decoration_manager_v1_destroy(ctx.deco_manager);
+
 	cursor_free();
 eglobals:
-	if (term.ps_dm)
-		zwp_primary_selection_device_manager_v1_destroy(term.ps_dm);
-	if (term.d_dm)
-		wl_data_device_manager_destroy(term.d_dm);
-	if (term.seat)
-		wl_seat_destroy(term.seat);
-	if (term.wm_base)
-		xdg_wm_base_destroy(term.wm_base);
-	if (term.shm)
-		wl_shm_destroy(term.shm);
-	if (term.cp)
-		wl_compositor_destroy(term.cp);
-
-	wl_registry_destroy(term.registry);
-	wl_display_flush(term.display);
-	wl_display_disconnect(term.display);
+	if (ctx.ps_dm)
+		zwp_primary_selection_device_manager_v1_destroy(ctx.ps_dm);
+	if (ctx.d_dm)
+		wl_data_device_manager_destroy(ctx.d_dm);
+	if (ctx.seat)
+		wl_seat_destroy(ctx.seat);
+	if (ctx.wm_base)
+		xdg_wm_base_destroy(ctx.wm_base);
+	if (ctx.shm)
+		wl_shm_destroy(ctx.shm);
+	if (ctx.cp)
+		wl_compositor_destroy(ctx.cp);
+
+	wl_registry_destroy(ctx.registry);
+	wl_display_flush(ctx.display);
+	wl_display_disconnect(ctx.display);
 
 econnect:
-	xkb_keymap_unref(term.xkb_keymap);
-	xkb_state_unref(term.xkb_state);
-	xkb_compose_table_unref(term.xkb_compose_table);
-	xkb_compose_state_unref(term.xkb_compose_state);
-	xkb_context_unref(term.xkb_ctx);
+	if (ctx.listen_fd >= 0)
+		close(ctx.listen_fd);
+	xkb_keymap_unref(ctx.xkb_keymap);
+	xkb_state_unref(ctx.xkb_state);
+	xkb_compose_table_unref(ctx.xkb_compose_table);
+	xkb_compose_state_unref(ctx.xkb_compose_state);
+	xkb_context_unref(ctx.xkb_ctx);
 exkb:
 	font_deinit();
 efont:
-	b = term.binding;
+	b = ctx.binding;
 	while (b) {
 		struct binding *tmp = b;
 		b = b->next;
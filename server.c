@@ -0,0 +1,245 @@
+/* server mode: one process loads the font, config and keyboard tables and
+ * opens a window for every client asking for one, all of them sharing the
+ * display connection and the glyph caches */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* a request is the working directory and the program to run, each string
+ * terminated by a zero byte */
+#define MAX_REQUEST (64 * 1024)
+#define MAX_ARGS 256
+
+#define error(s) { fprintf(stderr, s ": %s\n", strerror(errno)); }
+
+/* one client, its request comes in bit by bit */
+struct request {
+	int fd;
+	size_t len;
+	char buf[MAX_REQUEST];
+	char *args[MAX_ARGS + 1];
+};
+
+static int socket_path(struct sockaddr_un *addr)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	int n;
+
+	if (dir == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+		return -1;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	n = snprintf(addr->sun_path, sizeof(addr->sun_path),
+		     "%s/havoc.sock", dir);
+	if (n < 0 || (size_t)n >= sizeof(addr->sun_path)) {
+		fprintf(stderr, "socket path too long\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int connect_server(struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)addr, sizeof(*addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* asks the server for a window running @argv, or the shell if empty */
+int client_main(char *argv[])
+{
+	struct sockaddr_un addr;
+	char cwd[4096], ack;
+	int fd;
+
+	if (socket_path(&addr) < 0)
+		return EXIT_FAILURE;
+
+	fd = connect_server(&addr);
+	if (fd < 0) {
+		error("could not connect to havoc server");
+		return EXIT_FAILURE;
+	}
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		strcpy(cwd, "/");
+
+	if (write_all(fd, cwd, strlen(cwd) + 1) < 0)
+		goto fail;
+	for (; *argv; ++argv)
+		if (write_all(fd, *argv, strlen(*argv) + 1) < 0)
+			goto fail;
+	shutdown(fd, SHUT_WR);
+
+	/* the window is open once we hear back */
+	if (read(fd, &ack, 1) != 1) {
+		fprintf(stderr, "havoc server could not open a window\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+	return EXIT_SUCCESS;
+
+fail:
+	error("could not talk to havoc server");
+	close(fd);
+	return EXIT_FAILURE;
+}
+
+/* the socket clients connect to, handed to server_accept() once readable */
+int server_listen(void)
+{
+	struct sockaddr_un addr;
+	int lfd, fd;
+
+	if (socket_path(&addr) < 0)
+		exit(EXIT_FAILURE);
+
+	fd = connect_server(&addr);
+	if (fd >= 0) {
+		fprintf(stderr, "a havoc server is already running at %s\n",
+			addr.sun_path);
+		exit(EXIT_FAILURE);
+	}
+	unlink(addr.sun_path);
+
+	lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (lfd < 0 ||
+	    bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(lfd, 16) < 0) {
+		error("could not listen for clients");
+		exit(EXIT_FAILURE);
+	}
+	fcntl(lfd, F_SETFL, O_NONBLOCK);
+
+	return lfd;
+}
+
+/* Takes the next client, NULL if there is none. Its request is read with
+ * server_read() whenever its connection is readable, the main loop never
+ * waits for it. */
+struct request *server_accept(int lfd)
+{
+	struct request *r;
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EINTR &&
+		    errno != ECONNABORTED)
+			error("could not accept client");
+		return NULL;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	r = malloc(sizeof(*r));
+	if (r == NULL) {
+		fprintf(stderr, "could not accept client: out of memory\n");
+		close(fd);
+		return NULL;
+	}
+	r->fd = fd;
+	r->len = 0;
+
+	return r;
+}
+
+int server_fd(struct request *r)
+{
+	return r->fd;
+}
+
+/* splits the request, the strings stay in its buffer */
+static char **parse_request(struct request *r, char **cwd)
+{
+	char *p;
+	int i;
+
+	if (r->len == 0 || r->buf[r->len - 1] != '\0')
+		return NULL;
+
+	*cwd = r->buf;
+	p = r->buf + strlen(r->buf) + 1;
+	for (i = 0; p < r->buf + r->len && i < MAX_ARGS; ++i) {
+		r->args[i] = p;
+		p += strlen(p) + 1;
+	}
+	r->args[i] = NULL;
+
+	return r->args;
+}
+
+/* Reads what has come in of the request. Once all of it is there, the
+ * program to run and its working directory are stored in @argv and @cwd
+ * and 1 is returned. Returns 0 while more is to come, -1 if the client is
+ * to be dropped. */
+int server_read(struct request *r, char ***argv, char **cwd)
+{
+	ssize_t n;
+
+	for (;;) {
+		n = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return errno == EAGAIN ? 0 : -1;
+		if (n == 0)
+			break;
+
+		r->len += n;
+		if (r->len == sizeof(r->buf))
+			return -1;
+	}
+
+	/* nothing to do for clients only checking we are here */
+	*argv = parse_request(r, cwd);
+	return *argv ? 1 : -1;
+}
+
+/* lets the client go, telling it if its window is open */
+void server_done(struct request *r, bool ok)
+{
+	if (ok && write(r->fd, "", 1) != 1)
+		error("could not answer client");
+
+	close(r->fd);
+	free(r);
+}
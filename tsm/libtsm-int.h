@@ -37,7 +37,13 @@
 /* max combined-symbol length */
 #define TSM_UCS4_MAXLEN 10
 
-int tsm_wcwidth(wchar_t wc);
+/* number of scroll operations remembered for renderers */
+#define TSM_SCROLL_LOG 64
+
+/* scroll-back lines summarized together for searching, and the log2 of
+ * the bits in the trigram filter of each summary */
+#define SEARCH_CHUNK 64
+#define SEARCH_BLOOM_ORDER 13
 
 /* symbols */
 
@@ -48,12 +54,17 @@ extern const tsm_symbol_t tsm_symbol_default;
 int tsm_symbol_table_new(struct tsm_symbol_table **out);
 void tsm_symbol_table_ref(struct tsm_symbol_table *tbl);
 void tsm_symbol_table_unref(struct tsm_symbol_table *tbl);
+void tsm_symbol_table_frame(struct tsm_symbol_table *tbl);
+bool tsm_symbol_table_due(struct tsm_symbol_table *tbl);
+void tsm_symbol_mark(struct tsm_symbol_table *tbl, tsm_symbol_t sym);
+void tsm_symbol_table_collect(struct tsm_symbol_table *tbl);
 
 tsm_symbol_t tsm_symbol_make(uint32_t ucs4);
 tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4);
 const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t *sym, size_t *size);
+uint64_t tsm_symbol_draw_id(struct tsm_symbol_table *tbl, tsm_symbol_t sym);
 int tsm_symbol_get_width(struct tsm_symbol_table *tbl, tsm_symbol_t sym);
 
 /* utf8 state machine */
@@ -93,6 +104,31 @@ struct line {
 	struct cell *cells;		/* actuall cells */
 	uint64_t sb_id;			/* sb ID */
 	tsm_age_t age;			/* age of the whole line */
+	int width;			/* screen width when moved to sb */
+	bool wrapped;			/* text goes on in the next line */
+};
+
+struct search_chunk {
+	struct line *first;		/* oldest line still in sb */
+	uint64_t bits[(1 << SEARCH_BLOOM_ORDER) / 64];
+};
+
+/* search index over the scroll-back buffer and the last match */
+struct screen_search {
+	struct search_chunk *chunks;	/* ring of chunk summaries */
+	size_t head;			/* index of the oldest chunk */
+	size_t count;			/* chunks in use */
+	size_t size;			/* chunks allocated */
+	uint64_t base;			/* chunk number of the oldest chunk */
+
+	uint32_t *text;			/* scratch for the text of a line */
+	int *cell;			/* cell of each character in text */
+	int text_size;
+
+	bool found;			/* there is a last match */
+	uint64_t id;			/* its sb line, 0 if on screen */
+	int y;				/* its screen row */
+	int x;				/* its first cell */
 };
 
 #define SELECTION_TOP -1
@@ -106,6 +142,7 @@ struct tsm_screen {
 	size_t ref;
 	unsigned int opts;
 	unsigned int flags;
+	unsigned int syncs;		/* synchronized updates ended */
 	struct tsm_symbol_table *sym_table;
 
 	/* default attributes for new cells */
@@ -129,6 +166,18 @@ struct tsm_screen {
 	tsm_age_t age;			/* whole screen age */
 	int vanguard;			/* lowest non-empty line on screen */
 
+	/* scroll log: lets renderers move what they already drew */
+	struct screen_scroll {
+		tsm_age_t age;
+		int top;
+		int bottom;
+		int num;
+	} scroll_log[TSM_SCROLL_LOG];
+	int scroll_pos;			/* index of the oldest entry */
+	int scroll_cnt;			/* number of entries in the log */
+	tsm_age_t scroll_lost;		/* age of the newest dropped entry */
+	bool scroll_sealed;		/* drawn since the last entry */
+
 	/* scroll-back buffer */
 	int sb_count;			/* number of lines in sb */
 	struct line *sb_first;		/* first line; was moved first */
@@ -136,6 +185,15 @@ struct tsm_screen {
 	int sb_max;			/* max-limit of lines in sb */
 	struct line *sb_pos;		/* current position in sb or NULL */
 	uint64_t sb_last_id;		/* last id given to sb-line */
+	struct line **sb_index;		/* ring of all sb-lines by id */
+	size_t sb_index_size;		/* number of slots in sb_index */
+	size_t sb_index_head;		/* slot of sb_first */
+
+	/* Lines above sb_first still laid out for an older width. They are
+	 * rewrapped when scrolled to and count towards sb_max. */
+	struct line *sb_old_first;
+	struct line *sb_old_last;
+	int sb_old_count;
 
 	/* cursor: positions are always in-bound, but cursor_x might be
 	 * bigger than size_x if new-line is pending */
@@ -153,6 +211,10 @@ struct tsm_screen {
 	struct selection_pos sel_end;
 	int sel_target_x;
 	int sel_target_y;
+	struct tsm_screen_selection_reader *readers;
+
+	/* search */
+	struct screen_search search;
 };
 
 void screen_cell_init(struct tsm_screen *con, struct cell *cell,
@@ -164,11 +226,27 @@ unsigned int tsm_screen_get_opts(struct tsm_screen *scr);
 
 void tsm_screen_selection_retarget(struct tsm_screen *scr);
 
+int screen_sb_shown(struct tsm_screen *con);
+struct line *screen_sb_line(struct tsm_screen *con, uint64_t sb_id);
+void screen_sb_rewrap(struct tsm_screen *con, int num);
+void screen_select(struct tsm_screen *con, struct line *line, int y,
+		   int from, int to);
+void screen_selection_detach(struct tsm_screen *con);
+
+void screen_search_add(struct tsm_screen *con, struct line *line);
+void screen_search_drop(struct tsm_screen *con, struct line *line);
+void screen_search_clear(struct tsm_screen *con);
+void screen_search_free(struct tsm_screen *con);
+void screen_age_rows(struct tsm_screen *con, int from, int to);
+void screen_collect_symbols(struct tsm_screen *con);
+
 static inline void screen_inc_age(struct tsm_screen *con)
 {
 	if (!++con->age_cnt) {
 		con->age_reset = 1;
 		++con->age_cnt;
+		con->scroll_cnt = 0;
+		con->scroll_lost = 0;
 	}
 }
 
@@ -80,6 +80,9 @@ extern "C" {
 size_t tsm_ucs4_to_utf8(uint32_t ucs4, char *out);
 char *tsm_ucs4_to_utf8_alloc(const uint32_t *ucs4, size_t len, size_t *len_out);
 
+/* cells taken by a codepoint, -1 if it is not printable */
+int tsm_wcwidth(wchar_t wc);
+
 /* symbols */
 
 typedef uint32_t tsm_symbol_t;
@@ -113,6 +116,7 @@ typedef uint_fast32_t tsm_age_t;
 #define TSM_SCREEN_HIDE_CURSOR	0x10
 #define TSM_SCREEN_FIXED_POS	0x20
 #define TSM_SCREEN_ALTERNATE	0x40
+#define TSM_SCREEN_SYNC		0x80	/* hold back frames until reset */
 
 struct tsm_screen_attr {
 	int8_t fccode;			/* foreground color code or <0 for rgb */
@@ -124,14 +128,19 @@ struct tsm_screen_attr {
 	uint8_t bg;			/* background green */
 	uint8_t bb;			/* background blue */
 	unsigned int bold : 1;		/* bold character */
+	unsigned int italic : 1;	/* italic character */
 	unsigned int underline : 1;	/* underlined character */
 	unsigned int inverse : 1;	/* inverse colors */
 	unsigned int protect : 1;	/* cannot be erased */
 	unsigned int blink : 1;		/* blinking character */
 };
 
+/* @ch stays valid until the next tsm_screen_draw() of the screen. @id is
+ * the codepoint, or for combined symbols their ID above TSM_UCS4_MAX in the
+ * lower half and in the upper one how often that ID was reused. No two
+ * symbols ever get the same @id, and the upper two bits are always clear. */
 typedef void (*tsm_screen_draw_cb) (struct tsm_screen *con,
-				    uint32_t id,
+				    uint64_t id,
 				    const uint32_t *ch,
 				    size_t len,
 				    int width,
@@ -152,6 +161,8 @@ int tsm_screen_set_margins(struct tsm_screen *con, int top, int bottom);
 void tsm_screen_set_max_sb(struct tsm_screen *con, int max);
 void tsm_screen_clear_sb(struct tsm_screen *con);
 
+void tsm_screen_age_rows(struct tsm_screen *con, int from, int to);
+
 void tsm_screen_sb_up(struct tsm_screen *con, int num);
 void tsm_screen_sb_down(struct tsm_screen *con, int num);
 void tsm_screen_sb_page_up(struct tsm_screen *con, int num);
@@ -166,6 +177,7 @@ void tsm_screen_reset(struct tsm_screen *con);
 void tsm_screen_set_flags(struct tsm_screen *con, unsigned int flags);
 void tsm_screen_reset_flags(struct tsm_screen *con, unsigned int flags);
 unsigned int tsm_screen_get_flags(struct tsm_screen *con);
+unsigned int tsm_screen_get_syncs(struct tsm_screen *con);
 
 int tsm_screen_get_cursor_x(struct tsm_screen *con);
 int tsm_screen_get_cursor_y(struct tsm_screen *con);
@@ -214,9 +226,34 @@ void tsm_screen_selection_target(struct tsm_screen *con, int posx, int posy);
 void tsm_screen_selection_finish(struct tsm_screen *con);
 int tsm_screen_selection_copy(struct tsm_screen *con, char **out);
 
+struct tsm_screen_selection_reader;
+
+int tsm_screen_selection_reader_new(struct tsm_screen *con,
+				    struct tsm_screen_selection_reader **out);
+int tsm_screen_selection_reader_dup(struct tsm_screen_selection_reader *r,
+				    struct tsm_screen_selection_reader **out);
+void tsm_screen_selection_reader_free(struct tsm_screen_selection_reader *r);
+size_t tsm_screen_selection_read(struct tsm_screen *con,
+				 struct tsm_screen_selection_reader *r,
+				 char *buf, size_t size);
+
+int tsm_screen_search(struct tsm_screen *con, const uint32_t *str,
+		      size_t len, bool up);
+void tsm_screen_search_reset(struct tsm_screen *con);
+
 tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 			  void *data);
 
+/* lines @top to @bottom moved up by @num lines, or down if @num < 0 */
+struct tsm_screen_scroll {
+	int top;
+	int bottom;
+	int num;
+};
+
+int tsm_screen_get_scrolls(struct tsm_screen *con, tsm_age_t age,
+			   struct tsm_screen_scroll *out, int max);
+
 /** @} */
 
 /**
@@ -0,0 +1,253 @@
+/*
+ * libtsm - Ageing Tests
+ *
+ * Runs screen operations one at a time and checks which cells a redraw
+ * after each of them is handed, and which scrolls it gets to replay. The
+ * screen is drawn the way havoc does it: cells older than the last frame
+ * are skipped, logged scrolls are fetched before drawing.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+
+#define COLS 20
+#define ROWS 10
+
+static struct tsm_screen *screen;
+static tsm_age_t age;
+static bool dirty[ROWS][COLS];
+static bool want[ROWS][COLS];
+static struct tsm_screen_scroll scroll[8];
+static int num_scrolls;
+static int failed;
+
+static void draw_cb(struct tsm_screen *con, uint64_t id, const uint32_t *ch,
+		    size_t len, int width, int posx, int posy,
+		    const struct tsm_screen_attr *attr, tsm_age_t cell_age,
+		    void *data)
+{
+	if (cell_age && cell_age <= age)
+		return;
+
+	if (posx < 0 || posx >= COLS || posy < 0 || posy >= ROWS) {
+		fprintf(stderr, "cell %d,%d is off screen\n", posx, posy);
+		failed++;
+		return;
+	}
+
+	dirty[posy][posx] = true;
+}
+
+static void draw(void)
+{
+	num_scrolls = tsm_screen_get_scrolls(screen, age, scroll, 8);
+	memset(dirty, 0, sizeof dirty);
+	age = tsm_screen_draw(screen, draw_cb, NULL);
+}
+
+static void want_rows(int top, int bottom)
+{
+	int x, y;
+
+	for (y = top; y <= bottom; ++y)
+		for (x = 0; x < COLS; ++x)
+			want[y][x] = true;
+}
+
+/* scrolls replay the cursor cell along with the rows, so it is redrawn
+ * where it ends up even when the cursor is hidden */
+static void want_cell(int x, int y)
+{
+	want[y][x] = true;
+}
+
+/* exactly the wanted cells must have been drawn */
+static void expect_cells(const char *what)
+{
+	int x, y;
+
+	for (y = 0; y < ROWS; ++y) {
+		for (x = 0; x < COLS; ++x) {
+			if (dirty[y][x] == want[y][x])
+				continue;
+
+			fprintf(stderr, "%s: cell %d,%d %s\n", what, x, y,
+				want[y][x] ? "not drawn" : "drawn");
+			failed++;
+		}
+	}
+
+	memset(want, 0, sizeof want);
+}
+
+static void expect_scroll(const char *what, int top, int bottom, int num)
+{
+	if (num_scrolls == 1 && scroll[0].top == top &&
+	    scroll[0].bottom == bottom && scroll[0].num == num)
+		return;
+
+	fprintf(stderr, "%s: expected scroll %d..%d by %d, got %d scrolls",
+		what, top, bottom, num, num_scrolls);
+	if (num_scrolls > 0)
+		fprintf(stderr, ", first %d..%d by %d", scroll[0].top,
+			scroll[0].bottom, scroll[0].num);
+	fputc('\n', stderr);
+	failed++;
+}
+
+static void expect_no_scroll(const char *what)
+{
+	if (num_scrolls == 0)
+		return;
+
+	fprintf(stderr, "%s: expected no scrolls, got %d\n", what, num_scrolls);
+	failed++;
+}
+
+/* writes @n lines, each one filled with its own letter */
+static void fill(int n)
+{
+	struct tsm_screen_attr attr = { 0 };
+	int i, x;
+
+	for (i = 0; i < n; ++i) {
+		tsm_screen_move_line_home(screen);
+		for (x = 0; x < COLS - 1; ++x)
+			tsm_screen_write(screen, 'a' + i % 26, &attr);
+		if (i < n - 1)
+			tsm_screen_newline(screen);
+	}
+}
+
+int main(void)
+{
+	if (tsm_screen_new(&screen) < 0 ||
+	    tsm_screen_resize(screen, COLS, ROWS) < 0) {
+		fprintf(stderr, "could not create screen\n");
+		return 1;
+	}
+
+	tsm_screen_set_flags(screen, TSM_SCREEN_HIDE_CURSOR);
+	tsm_screen_set_max_sb(screen, 50);
+	draw();
+	want_rows(0, ROWS - 1);
+	expect_cells("first frame");
+
+	fill(15);
+	draw();
+	draw();
+	expect_cells("idle");
+	expect_no_scroll("idle");
+
+	tsm_screen_move_to(screen, 3, 4);
+	tsm_screen_erase_current_line(screen, false);
+	draw();
+	want_rows(4, 4);
+	expect_cells("erase line");
+	expect_no_scroll("erase line");
+
+	tsm_screen_set_margins(screen, 3, 7);
+	tsm_screen_scroll_up(screen, 1);
+	draw();
+	want_rows(6, 6);
+	want_cell(3, 3);
+	want_cell(3, 4);
+	expect_cells("region scroll up");
+	expect_scroll("region scroll up", 2, 6, 1);
+
+	tsm_screen_scroll_down(screen, 2);
+	draw();
+	want_rows(2, 3);
+	want_cell(3, 4);
+	want_cell(3, 6);
+	expect_cells("region scroll down");
+	expect_scroll("region scroll down", 2, 6, -2);
+	tsm_screen_set_margins(screen, 0, 0);
+
+	tsm_screen_move_to(screen, 0, 4);
+	tsm_screen_insert_lines(screen, 2);
+	draw();
+	want_rows(4, 5);
+	want_cell(0, 6);
+	expect_cells("insert lines");
+	expect_scroll("insert lines", 4, 9, -2);
+
+	tsm_screen_delete_lines(screen, 1);
+	draw();
+	want_rows(9, 9);
+	want_cell(0, 4);
+	expect_cells("delete lines");
+	expect_scroll("delete lines", 4, 9, 1);
+
+	tsm_screen_move_to(screen, 5, 2);
+	tsm_screen_insert_chars(screen, 3);
+	draw();
+	want_rows(2, 2);
+	expect_cells("insert chars");
+	expect_no_scroll("insert chars");
+
+	tsm_screen_delete_chars(screen, 1);
+	draw();
+	want_rows(2, 2);
+	expect_cells("delete chars");
+	expect_no_scroll("delete chars");
+
+	tsm_screen_sb_up(screen, 3);
+	draw();
+	want_rows(0, 2);
+	expect_cells("sb up");
+	expect_scroll("sb up", 0, 9, -3);
+
+	tsm_screen_sb_down(screen, 1);
+	draw();
+	want_rows(9, 9);
+	expect_cells("sb down");
+	expect_scroll("sb down", 0, 9, 1);
+
+	tsm_screen_sb_reset(screen);
+	draw();
+	want_rows(8, 9);
+	expect_cells("sb reset");
+	expect_scroll("sb reset", 0, 9, 2);
+
+	/* none of the dropped lines are shown */
+	tsm_screen_set_max_sb(screen, 4);
+	draw();
+	expect_cells("shrink hidden sb");
+	expect_no_scroll("shrink hidden sb");
+
+	tsm_screen_sb_up(screen, 4);
+	draw();
+	tsm_screen_set_max_sb(screen, 2);
+	draw();
+	want_rows(0, ROWS - 1);
+	expect_cells("shrink shown sb");
+
+	tsm_screen_sb_reset(screen);
+	draw();
+	tsm_screen_clear_sb(screen);
+	draw();
+	expect_cells("clear hidden sb");
+	expect_no_scroll("clear hidden sb");
+
+	tsm_screen_move_to(screen, 0, ROWS - 1);
+	fill(3);
+	tsm_screen_sb_up(screen, 1);
+	draw();
+	tsm_screen_clear_sb(screen);
+	draw();
+	want_rows(0, ROWS - 1);
+	expect_cells("clear shown sb");
+
+	tsm_screen_unref(screen);
+
+	if (failed) {
+		fprintf(stderr, "%d ageing checks failed\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -56,6 +56,8 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 	bool was_sel = false;
 	tsm_age_t age;
 
+	tsm_symbol_table_frame(con->sym_table);
+	screen_collect_symbols(con);
 	screen_cell_init(con, &empty, &con->def_attr);
 
 	cur_x = con->cursor_x;
@@ -162,11 +164,14 @@ tsm_age_t tsm_screen_draw(struct tsm_screen *con, tsm_screen_draw_cb draw_cb,
 			    cell->ch == ' ' ||
 			    cell->ch == 0xA0)
 				len = 0;
-			draw_cb(con, cell->ch, ch, len, cell->width,
+			draw_cb(con, tsm_symbol_draw_id(con->sym_table, cell->ch),
+				ch, len, cell->width,
 				j, i, &attr, age, data);
 		}
 	}
 
+	con->scroll_sealed = true;
+
 	if (con->age_reset) {
 		con->age_reset = 0;
 		return 0;
@@ -135,6 +135,8 @@ static int line_new(struct tsm_screen *con, struct line **out, int width,
 	line->prev = NULL;
 	line->size = width;
 	line->age = con->age_cnt;
+	line->width = width;
+	line->wrapped = false;
 
 	line->cells = malloc(sizeof(struct cell) * width);
 	if (!line->cells) {
@@ -176,15 +178,242 @@ static int line_resize(struct tsm_screen *con, struct line *line, int width,
 	return 0;
 }
 
+/* Number of scroll-back lines shown above the screen lines */
+int screen_sb_shown(struct tsm_screen *con)
+{
+	if (!con->sb_pos)
+		return 0;
+
+	return con->sb_last->sb_id - con->sb_pos->sb_id + 1;
+}
+
+/* The scroll-back line with id @sb_id, or NULL if it is not in the buffer.
+ * Ids of the buffer are consecutive, lines only leave it at the top. */
+struct line *screen_sb_line(struct tsm_screen *con, uint64_t sb_id)
+{
+	if (!con->sb_first || sb_id < con->sb_first->sb_id ||
+	    sb_id > con->sb_last->sb_id)
+		return NULL;
+
+	return con->sb_index[(con->sb_index_head + sb_id -
+			      con->sb_first->sb_id) % con->sb_index_size];
+}
+
+static int sb_index_grow(struct tsm_screen *con)
+{
+	struct line **index;
+	size_t i, size;
+
+	size = con->sb_index_size ? con->sb_index_size * 2 : 256;
+	index = malloc(size * sizeof(*index));
+	if (!index)
+		return -ENOMEM;
+
+	for (i = 0; i < (size_t)con->sb_count; ++i)
+		index[i] = con->sb_index[(con->sb_index_head + i) %
+					 con->sb_index_size];
+
+	free(con->sb_index);
+	con->sb_index = index;
+	con->sb_index_size = size;
+	con->sb_index_head = 0;
+	return 0;
+}
+
+static void sb_index_pop(struct tsm_screen *con)
+{
+	con->sb_index_head = (con->sb_index_head + 1) % con->sb_index_size;
+}
+
+/* drops the oldest line not rewrapped yet */
+static void sb_old_pop(struct tsm_screen *con)
+{
+	struct line *line = con->sb_old_first;
+
+	con->sb_old_first = line->next;
+	if (line->next)
+		line->next->prev = NULL;
+	else
+		con->sb_old_last = NULL;
+	--con->sb_old_count;
+	line_free(line);
+}
+
+/* links a rewrapped line in above sb_first, false if there is no room */
+static bool sb_prepend(struct tsm_screen *con, struct line *line)
+{
+	if (con->sb_count + con->sb_old_count >= con->sb_max)
+		return false;
+	if (con->sb_count == (int)con->sb_index_size &&
+	    sb_index_grow(con) < 0)
+		return false;
+
+	line->sb_id = con->sb_first ? con->sb_first->sb_id - 1 :
+				      ++con->sb_last_id;
+	line->prev = NULL;
+	line->next = con->sb_first;
+	if (con->sb_first)
+		con->sb_first->prev = line;
+	else
+		con->sb_last = line;
+	con->sb_first = line;
+	con->sb_index_head = (con->sb_index_head + con->sb_index_size - 1) %
+			     con->sb_index_size;
+	con->sb_index[con->sb_index_head] = line;
+	++con->sb_count;
+	screen_search_add(con, line);
+	return true;
+}
+
+/* Marks the lines shown in rows @from to @to as changed */
+void screen_age_rows(struct tsm_screen *con, int from, int to)
+{
+	struct line *iter, *line;
+	int i, k = 0;
+
+	if (from < 0)
+		from = 0;
+	if (to >= con->size_y)
+		to = con->size_y - 1;
+
+	iter = con->sb_pos;
+	for (i = 0; i <= to; ++i) {
+		if (iter) {
+			line = iter;
+			iter = iter->next;
+		} else {
+			line = con->lines[k++];
+		}
+
+		if (i >= from)
+			line->age = con->age_cnt;
+	}
+}
+
+static void line_mark_symbols(struct tsm_screen *con, struct line *line)
+{
+	int i;
+
+	for (i = 0; i < line->size; ++i)
+		tsm_symbol_mark(con->sym_table, line->cells[i].ch);
+}
+
+/* Drops the combined symbols no line uses anymore. This looks at every
+ * cell, the symbol table only asks for it once enough new symbols came in.
+ * Called before drawing and after each new symbol. */
+void screen_collect_symbols(struct tsm_screen *con)
+{
+	struct line *line;
+	int i;
+
+	if (!tsm_symbol_table_due(con->sym_table))
+		return;
+
+	for (i = 0; i < con->line_num; ++i) {
+		line_mark_symbols(con, con->main_lines[i]);
+		line_mark_symbols(con, con->alt_lines[i]);
+	}
+	for (line = con->sb_first; line; line = line->next)
+		line_mark_symbols(con, line);
+	for (line = con->sb_old_first; line; line = line->next)
+		line_mark_symbols(con, line);
+
+	tsm_symbol_table_collect(con->sym_table);
+}
+
+/* Records that the shown rows @top to @bottom moved up by @num, which is
+ * negative when moving down. Consecutive moves of the same region are merged
+ * as long as nobody drew the screen in between. */
+static void screen_log_scroll(struct tsm_screen *con, int top, int bottom,
+			      int num)
+{
+	struct screen_scroll *s;
+
+	if (con->scroll_cnt && !con->scroll_sealed) {
+		s = &con->scroll_log[(con->scroll_pos + con->scroll_cnt - 1) %
+				     TSM_SCROLL_LOG];
+		if (s->top == top && s->bottom == bottom &&
+		    (s->num > 0) == (num > 0)) {
+			s->age = con->age_cnt;
+			s->num += num;
+			return;
+		}
+	}
+
+	if (con->scroll_cnt == TSM_SCROLL_LOG) {
+		con->scroll_lost = con->scroll_log[con->scroll_pos].age;
+		con->scroll_pos = (con->scroll_pos + 1) % TSM_SCROLL_LOG;
+		--con->scroll_cnt;
+	}
+
+	s = &con->scroll_log[(con->scroll_pos + con->scroll_cnt) %
+			     TSM_SCROLL_LOG];
+	s->age = con->age_cnt;
+	s->top = top;
+	s->bottom = bottom;
+	s->num = num;
+	++con->scroll_cnt;
+	con->scroll_sealed = false;
+}
+
+/* Screen lines @top to @bottom moved by @num. They do not move on screen
+ * while the scroll-back buffer is shown, and a selection does not move with
+ * them, so just redraw everything then. */
+static void screen_lines_moved(struct tsm_screen *con, int top, int bottom,
+			       int num)
+{
+	if (con->sb_pos || con->sel_active)
+		con->age = con->age_cnt;
+	else
+		screen_log_scroll(con, top, bottom, num);
+}
+
+SHL_EXPORT
+int tsm_screen_get_scrolls(struct tsm_screen *con, tsm_age_t age,
+			   struct tsm_screen_scroll *out, int max)
+{
+	struct screen_scroll *s;
+	int i, n = 0;
+
+	/* everything newer than @age gets redrawn anyway, or we lost track */
+	if (!con || !age || con->age_reset || age < con->age ||
+	    age < con->scroll_lost)
+		return -1;
+
+	for (i = 0; i < con->scroll_cnt; ++i) {
+		s = &con->scroll_log[(con->scroll_pos + i) % TSM_SCROLL_LOG];
+		if (s->age <= age)
+			continue;
+		if (n == max)
+			return -1;
+		out[n].top = s->top;
+		out[n].bottom = s->bottom;
+		out[n].num = s->num;
+		++n;
+	}
+
+	return n;
+}
+
 /* This links the given line into the scrollback-buffer */
 static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 {
 	struct line *tmp;
 
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	/* the shown part of the scroll-back buffer may move */
+	if (con->sb_pos)
+		con->age = con->age_cnt;
 
-	if (con->sb_max == 0) {
+	/* if the index cannot grow, the buffer is as full as it gets */
+	if (con->sb_count == (int)con->sb_index_size)
+		sb_index_grow(con);
+
+	/* lines not rewrapped yet are the oldest ones */
+	if (con->sb_old_last &&
+	    con->sb_count + con->sb_old_count >= con->sb_max)
+		sb_old_pop(con);
+
+	if (con->sb_max == 0 || !con->sb_index_size) {
 		if (con->sel_active) {
 			if (con->sel_start.line == line) {
 				con->sel_start.line = NULL;
@@ -204,8 +433,10 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	 * line is linked in after we remove the top-most line here.
 	 * sb_max == 0 is tested earlier so we can assume sb_max > 0 here. In
 	 * other words, buf->sb_first is a valid line if sb_count >= sb_max. */
-	if (con->sb_count >= con->sb_max) {
+	if (con->sb_count >= con->sb_max ||
+	    con->sb_count == (int)con->sb_index_size) {
 		tmp = con->sb_first;
+		sb_index_pop(con);
 		con->sb_first = tmp->next;
 		if (tmp->next)
 			tmp->next->prev = NULL;
@@ -239,10 +470,12 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 				con->sel_end.y = SELECTION_TOP;
 			}
 		}
+		screen_search_drop(con, tmp);
 		line_free(tmp);
 	}
 
 	line->sb_id = ++con->sb_last_id;
+	line->width = con->size_x;
 	line->next = NULL;
 	line->prev = con->sb_last;
 	if (con->sb_last)
@@ -250,7 +483,10 @@ static void link_to_scrollback(struct tsm_screen *con, struct line *line)
 	else
 		con->sb_first = line;
 	con->sb_last = line;
+	con->sb_index[(con->sb_index_head + con->sb_count) %
+		      con->sb_index_size] = line;
 	++con->sb_count;
+	screen_search_add(con, line);
 }
 
 static void screen_scroll_up_(struct tsm_screen *con, int num)
@@ -261,9 +497,6 @@ static void screen_scroll_up_(struct tsm_screen *con, int num)
 	if (!num)
 		return;
 
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
-
 	max = con->margin_bottom + 1 - con->margin_top;
 	if (num > max)
 		num = max;
@@ -280,6 +513,9 @@ static void screen_scroll_up_(struct tsm_screen *con, int num)
 	}
 	struct line *cache[num];
 
+	/* the cursor stays where it is while the text moves under it */
+	get_cursor_cell(con)->age = con->age_cnt;
+
 	for (i = 0; i < num; ++i) {
 		pos = con->margin_top + i;
 		if (!(con->flags & TSM_SCREEN_ALTERNATE))
@@ -295,6 +531,7 @@ static void screen_scroll_up_(struct tsm_screen *con, int num)
 			for (j = 0; j < con->size_x; ++j)
 				screen_cell_init(con, &cache[i]->cells[j],
 						 &con->def_attr);
+			cache[i]->wrapped = false;
 		}
 		con->vanguard--;
 	}
@@ -310,6 +547,9 @@ static void screen_scroll_up_(struct tsm_screen *con, int num)
 	memcpy(&con->lines[con->margin_top + (max - num)],
 	       cache, num * sizeof(struct line*));
 
+	get_cursor_cell(con)->age = con->age_cnt;
+	screen_lines_moved(con, con->margin_top, con->margin_bottom, num);
+
 	if (con->sel_active) {
 		if (!con->sel_start.line && con->sel_start.y >= 0) {
 			con->sel_start.y -= num;
@@ -345,9 +585,6 @@ static void screen_scroll_down_(struct tsm_screen *con, int num)
 	if (!num)
 		return;
 
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
-
 	max = con->margin_bottom + 1 - con->margin_top;
 	if (num > max)
 		num = max;
@@ -360,11 +597,14 @@ static void screen_scroll_down_(struct tsm_screen *con, int num)
 	}
 	struct line *cache[num];
 
+	get_cursor_cell(con)->age = con->age_cnt;
+
 	for (i = 0; i < num; ++i) {
 		cache[i] = con->lines[con->margin_bottom - i];
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j],
 					 &con->def_attr);
+		cache[i]->wrapped = false;
 		con->vanguard++;
 	}
 	if (con->vanguard >= con->size_y)
@@ -379,6 +619,9 @@ static void screen_scroll_down_(struct tsm_screen *con, int num)
 	memcpy(&con->lines[con->margin_top],
 	       cache, num * sizeof(struct line*));
 
+	get_cursor_cell(con)->age = con->age_cnt;
+	screen_lines_moved(con, con->margin_top, con->margin_bottom, -num);
+
 	if (con->sel_active) {
 		if (!con->sel_start.line && con->sel_start.y >= 0)
 			con->sel_start.y += num;
@@ -437,9 +680,6 @@ static void screen_erase_region(struct tsm_screen *con,
 	int to;
 	struct line *line;
 
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
-
 	if (y_to >= con->size_y)
 		y_to = con->size_y - 1;
 	if (x_to >= con->size_x)
@@ -456,6 +696,8 @@ static void screen_erase_region(struct tsm_screen *con,
 			to = x_to;
 		else
 			to = con->size_x - 1;
+		if (to == con->size_x - 1)
+			line->wrapped = false;
 		for ( ; x_from <= to; ++x_from) {
 			if (protect && line->cells[x_from].attr.protect)
 				continue;
@@ -544,7 +786,10 @@ void tsm_screen_unref(struct tsm_screen *con)
 	if (!con->ref || --con->ref)
 		return;
 
+	screen_selection_detach(con);
 	tsm_screen_clear_sb(con);
+	screen_search_free(con);
+	free(con->sb_index);
 	for (i = 0; i < con->line_num; ++i) {
 		line_free(con->main_lines[i]);
 		line_free(con->alt_lines[i]);
@@ -583,6 +828,311 @@ int tsm_screen_get_height(struct tsm_screen *con)
 	return con->size_y;
 }
 
+/* Text is rewrapped a logical line at a time, that is a run of lines all
+ * but the last of which are wrapped. Wide characters are never split, a
+ * row without room for one ends early. */
+struct reflow {
+	struct tsm_screen *con;
+	int width;			/* new width */
+	struct line **rows;		/* rows laid out so far */
+	int num;
+	int size;
+	int x;				/* next cell of the last row */
+	bool cont;			/* the last line was wrapped */
+	int mark;			/* cell of the next line looked for */
+	int mark_y, mark_x;		/* where it went */
+};
+
+static int reflow_row(struct reflow *rf)
+{
+	struct line **rows;
+	int size;
+
+	if (rf->num == rf->size) {
+		size = rf->size ? rf->size * 2 : 64;
+		rows = realloc(rf->rows, size * sizeof(*rows));
+		if (!rows)
+			return -ENOMEM;
+		rf->rows = rows;
+		rf->size = size;
+	}
+
+	if (line_new(rf->con, &rf->rows[rf->num], rf->width,
+		     &rf->con->def_attr) < 0)
+		return -ENOMEM;
+	++rf->num;
+	rf->x = 0;
+	return 0;
+}
+
+/* appends @line, laid out for @width cells and followed by @next, to the
+ * rows */
+static int reflow_line(struct reflow *rf, struct line *line, int width,
+		       struct line *next)
+{
+	struct cell *cell;
+	struct line *row;
+	int i, j, w, len;
+
+	len = width < line->size ? width : line->size;
+	if (line->wrapped) {
+		/* the cell left over by a wide character that did not fit */
+		if (next && next->cells[0].width > 1 && len &&
+		    !line->cells[len - 1].ch && line->cells[len - 1].width == 1)
+			--len;
+	} else {
+		while (len && !line->cells[len - 1].ch &&
+		       line->cells[len - 1].width == 1)
+			--len;
+		if (len <= rf->mark)
+			len = rf->mark + 1;
+	}
+
+	if (!rf->cont && reflow_row(rf) < 0)
+		return -ENOMEM;
+	rf->cont = line->wrapped;
+
+	for (i = 0; i < len; ++i) {
+		cell = &line->cells[i];
+
+		/* right halves come back with their character */
+		if (!cell->width) {
+			if (i == rf->mark) {
+				rf->mark_y = rf->num - 1;
+				rf->mark_x = rf->x ? rf->x - 1 : 0;
+			}
+			continue;
+		}
+
+		w = cell->width < rf->width ? cell->width : rf->width;
+		if (rf->x + w > rf->width) {
+			rf->rows[rf->num - 1]->wrapped = true;
+			if (reflow_row(rf) < 0)
+				return -ENOMEM;
+		}
+
+		if (i == rf->mark) {
+			rf->mark_y = rf->num - 1;
+			rf->mark_x = rf->x;
+		}
+
+		row = rf->rows[rf->num - 1];
+		row->cells[rf->x] = *cell;
+		for (j = 1; j < w; ++j) {
+			row->cells[rf->x + j] = *cell;
+			row->cells[rf->x + j].ch = 0;
+			row->cells[rf->x + j].width = 0;
+		}
+		rf->x += w;
+	}
+
+	rf->mark = -1;
+	return 0;
+}
+
+static void reflow_free(struct reflow *rf, int from)
+{
+	int i;
+
+	for (i = from; i < rf->num; ++i)
+		line_free(rf->rows[i]);
+	free(rf->rows);
+}
+
+/* Rewraps older lines for the current width until @num more are above
+ * sb_first, or none are left. Called as they are scrolled to. */
+void screen_sb_rewrap(struct tsm_screen *con, int num)
+{
+	struct reflow rf;
+	struct line *head, *line;
+	int i, done = 0;
+
+	/* a few screens at a time, scrolling goes on in small steps */
+	if (num < 256)
+		num = 256;
+
+	while (con->sb_old_last && done < num) {
+		memset(&rf, 0, sizeof(rf));
+		rf.con = con;
+		rf.width = con->size_x;
+		rf.mark = -1;
+
+		head = con->sb_old_last;
+		while (head->prev && head->prev->wrapped)
+			head = head->prev;
+
+		for (line = head; line; line = line->next) {
+			if (reflow_line(&rf, line, line->width,
+					line->next) < 0) {
+				reflow_free(&rf, 0);
+				return;
+			}
+		}
+
+		con->sb_old_last = head->prev;
+		if (head->prev)
+			head->prev->next = NULL;
+		else
+			con->sb_old_first = NULL;
+		while (head) {
+			line = head;
+			head = head->next;
+			--con->sb_old_count;
+			line_free(line);
+		}
+
+		for (i = rf.num; i > 0; --i) {
+			if (!sb_prepend(con, rf.rows[i - 1]))
+				break;
+		}
+		done += rf.num - i;
+
+		/* out of room, whatever is older goes */
+		if (i) {
+			while (con->sb_old_last)
+				sb_old_pop(con);
+			rf.num = i;
+			reflow_free(&rf, 0);
+			break;
+		}
+		free(rf.rows);
+	}
+}
+
+/* the lines above and below @line, across the lines not rewrapped yet */
+static struct line *sb_older(struct tsm_screen *con, struct line *line)
+{
+	return line == con->sb_first ? con->sb_old_last : line->prev;
+}
+
+static struct line *sb_newer(struct tsm_screen *con, struct line *line)
+{
+	return line == con->sb_old_last ? con->sb_first : line->next;
+}
+
+/* Rewraps the main screen for @x columns and @y rows, along with the text
+ * in the scroll-back buffer wrapping into its first row. The rest of the
+ * buffer is rewrapped when scrolled to. The lines must already be big
+ * enough for both widths, nothing changes if this fails. */
+static int screen_reflow(struct tsm_screen *con, int x, int y)
+{
+	struct reflow rf;
+	struct line *head = NULL, *line, *next;
+	int i, j, last, top, shown, cx;
+
+	memset(&rf, 0, sizeof(rf));
+	rf.con = con;
+	rf.width = x;
+	rf.mark = -1;
+
+	line = con->sb_last ? con->sb_last : con->sb_old_last;
+	for ( ; line && line->wrapped; line = sb_older(con, line))
+		head = line;
+
+	last = con->cursor_y;
+	for (i = con->size_y - 1; i > last; --i) {
+		line = con->lines[i];
+		for (j = 0; j < con->size_x && !line->cells[j].ch; ++j)
+			;
+		if (j < con->size_x)
+			last = i;
+	}
+
+	for (line = head; line; line = next) {
+		next = sb_newer(con, line);
+		if (reflow_line(&rf, line, line->width,
+				next ? next : con->lines[0]) < 0)
+			goto err;
+	}
+
+	cx = con->cursor_x < con->size_x ? con->cursor_x : con->size_x - 1;
+	for (i = 0; i <= last; ++i) {
+		if (i == con->cursor_y)
+			rf.mark = cx;
+		if (reflow_line(&rf, con->lines[i], con->size_x,
+				i < last ? con->lines[i + 1] : NULL) < 0)
+			goto err;
+	}
+
+	/* nothing can fail from here on */
+	screen_selection_detach(con);
+	screen_search_clear(con);
+	con->sel_active = false;
+	con->sb_pos = NULL;
+
+	/* the buffer waits to be rewrapped above the new lines */
+	if (con->sb_first) {
+		con->sb_first->prev = con->sb_old_last;
+		if (con->sb_old_last)
+			con->sb_old_last->next = con->sb_first;
+		else
+			con->sb_old_first = con->sb_first;
+		con->sb_old_last = con->sb_last;
+		con->sb_old_count += con->sb_count;
+		con->sb_first = NULL;
+		con->sb_last = NULL;
+		con->sb_count = 0;
+		con->sb_index_head = 0;
+	}
+
+	/* but not the text laid out with the screen */
+	if (head) {
+		con->sb_old_last = head->prev;
+		if (head->prev)
+			head->prev->next = NULL;
+		else
+			con->sb_old_first = NULL;
+		while (head) {
+			line = head;
+			head = head->next;
+			--con->sb_old_count;
+			line_free(line);
+		}
+	}
+
+	/* ids of rewrapped lines go down from where new ones start, leave
+	 * room for all of them */
+	con->sb_last_id = (con->sb_last_id + con->sb_max) /
+			  SEARCH_CHUNK * SEARCH_CHUNK + SEARCH_CHUNK;
+
+	/* keep the cursor row shown, then as much of the text as fits */
+	top = rf.num > y ? rf.num - y : 0;
+	if (top > rf.mark_y)
+		top = rf.mark_y;
+	shown = rf.num - top < y ? rf.num - top : y;
+
+	con->size_x = x;
+	for (i = 0; i < top; ++i)
+		link_to_scrollback(con, rf.rows[i]);
+
+	/* the lines of rows the text does not take are kept, cleared */
+	for (i = 0; i < con->line_num; ++i) {
+		line = con->lines[i];
+		if (i < shown) {
+			line_free(line);
+			con->lines[i] = rf.rows[top + i];
+			continue;
+		}
+		for (j = 0; j < line->size; ++j)
+			screen_cell_init(con, &line->cells[j],
+					 &con->def_attr);
+		line->wrapped = false;
+	}
+	reflow_free(&rf, top + shown);
+
+	con->vanguard = shown - 1;
+	con->cursor_y = rf.mark_y - top;
+	con->cursor_x = rf.mark_x + con->cursor_x - cx;
+	if (con->cursor_x > x)
+		con->cursor_x = x;
+
+	return 0;
+
+err:
+	reflow_free(&rf, 0);
+	return -ENOMEM;
+}
+
 SHL_EXPORT
 int tsm_screen_resize(struct tsm_screen *con, int x, int y)
 {
@@ -676,6 +1226,13 @@ int tsm_screen_resize(struct tsm_screen *con, int x, int y)
 
 	screen_inc_age(con);
 
+	/* The text of the main screen is rewrapped. Applications on the
+	 * alternate one redraw it themselves, and the main one is left as it
+	 * is meanwhile. */
+	if (x != con->size_x && con->size_x &&
+	    !(con->flags & TSM_SCREEN_ALTERNATE))
+		screen_reflow(con, x, y);
+
 	/* xterm destroys margins on resize, so do we */
 	con->margin_top = 0;
 	con->margin_bottom = con->size_y - 1;
@@ -713,6 +1270,9 @@ int tsm_screen_resize(struct tsm_screen *con, int x, int y)
 	if (con->cursor_y >= con->size_y)
 		move_cursor(con, con->cursor_x, con->size_y - 1);
 
+	/* rows shown before do not mean anything anymore */
+	con->age = con->age_cnt;
+
 	return 0;
 }
 
@@ -747,11 +1307,18 @@ void tsm_screen_set_max_sb(struct tsm_screen *con, int max)
 	struct line *line;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+
+	while (con->sb_old_last && con->sb_count + con->sb_old_count > max)
+		sb_old_pop(con);
+
+	/* only visible if we drop shown or selected lines */
+	if (con->sb_count > max && (con->sb_pos || con->sel_active))
+		con->age = con->age_cnt;
 
 	while (con->sb_count > max) {
 		line = con->sb_first;
+		screen_search_drop(con, line);
+		sb_index_pop(con);
 		con->sb_first = line->next;
 		if (line->next)
 			line->next->prev = NULL;
@@ -787,18 +1354,23 @@ void tsm_screen_clear_sb(struct tsm_screen *con)
 	struct line *iter, *tmp;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+
+	if (con->sb_pos || con->sel_active)
+		con->age = con->age_cnt;
 
 	for (iter = con->sb_first; iter; ) {
 		tmp = iter;
 		iter = iter->next;
 		line_free(tmp);
 	}
+	while (con->sb_old_last)
+		sb_old_pop(con);
+	screen_search_clear(con);
 
 	con->sb_first = NULL;
 	con->sb_last = NULL;
 	con->sb_count = 0;
+	con->sb_index_head = 0;
 	con->sb_pos = NULL;
 
 	if (con->sel_active) {
@@ -813,27 +1385,48 @@ void tsm_screen_clear_sb(struct tsm_screen *con)
 	}
 }
 
+/* rows @from to @to are drawn again, for renderers that painted over them */
+SHL_EXPORT
+void tsm_screen_age_rows(struct tsm_screen *con, int from, int to)
+{
+	screen_inc_age(con);
+	screen_age_rows(con, from, to);
+}
+
 SHL_EXPORT
 void tsm_screen_sb_up(struct tsm_screen *con, int num)
 {
-	if (!num)
+	uint64_t top;
+	int moved;
+
+	if (num <= 0)
 		return;
 
-	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	/* lines further up may still need rewrapping */
+	moved = 0;
+	if (con->sb_first)
+		moved = (con->sb_pos ? con->sb_pos->sb_id :
+			 con->sb_last->sb_id + 1) - con->sb_first->sb_id;
+	if (moved < num)
+		screen_sb_rewrap(con, num - moved);
+	if (!con->sb_first)
+		return;
 
-	while (num--) {
-		if (con->sb_pos) {
-			if (!con->sb_pos->prev)
-				break;
+	screen_inc_age(con);
 
-			con->sb_pos = con->sb_pos->prev;
-		} else if (!con->sb_last) {
-			break;
-		} else {
-			con->sb_pos = con->sb_last;
-		}
+	top = con->sb_pos ? con->sb_pos->sb_id : con->sb_last->sb_id + 1;
+	moved = top - con->sb_first->sb_id;
+	if (moved > num)
+		moved = num;
+	if (moved)
+		con->sb_pos = screen_sb_line(con, top - moved);
+
+	/* everything moves down, only the lines on top are new */
+	if (moved && moved < con->size_y) {
+		screen_log_scroll(con, 0, con->size_y - 1, -moved);
+		screen_age_rows(con, 0, moved - 1);
+	} else if (moved) {
+		con->age = con->age_cnt;
 	}
 
 	tsm_screen_selection_retarget(con);
@@ -842,18 +1435,24 @@ void tsm_screen_sb_up(struct tsm_screen *con, int num)
 SHL_EXPORT
 void tsm_screen_sb_down(struct tsm_screen *con, int num)
 {
-	if (!num)
+	int moved;
+
+	if (num <= 0 || !con->sb_pos)
 		return;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
 
-	while (num--) {
-		if (con->sb_pos)
-			con->sb_pos = con->sb_pos->next;
-		else
-			break;
+	moved = screen_sb_shown(con);
+	if (moved > num)
+		moved = num;
+	con->sb_pos = screen_sb_line(con, con->sb_pos->sb_id + moved);
+
+	/* everything moves up, only the lines at the bottom are new */
+	if (moved && moved < con->size_y) {
+		screen_log_scroll(con, 0, con->size_y - 1, moved);
+		screen_age_rows(con, con->size_y - moved, con->size_y - 1);
+	} else if (moved) {
+		con->age = con->age_cnt;
 	}
 
 	tsm_screen_selection_retarget(con);
@@ -882,15 +1481,23 @@ void tsm_screen_sb_page_down(struct tsm_screen *con, int num)
 SHL_EXPORT
 bool tsm_screen_sb_reset(struct tsm_screen *con)
 {
+	int moved;
+
 	if (!con->sb_pos)
 		return false;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
 
+	moved = screen_sb_shown(con);
 	con->sb_pos = NULL;
 
+	if (moved < con->size_y) {
+		screen_log_scroll(con, 0, con->size_y - 1, moved);
+		screen_age_rows(con, con->size_y - moved, con->size_y - 1);
+	} else {
+		con->age = con->age_cnt;
+	}
+
 	tsm_screen_selection_retarget(con);
 
 	return true;
@@ -920,6 +1527,8 @@ void tsm_screen_reset(struct tsm_screen *con)
 	screen_inc_age(con);
 	con->age = con->age_cnt;
 
+	if (con->flags & TSM_SCREEN_SYNC)
+		con->syncs++;
 	con->flags = 0;
 	con->margin_top = 0;
 	con->margin_bottom = con->size_y - 1;
@@ -997,6 +1606,9 @@ void tsm_screen_reset_flags(struct tsm_screen *con, unsigned int flags)
 
 	if ((old & TSM_SCREEN_INVERSE) && (flags & TSM_SCREEN_INVERSE))
 		con->age = con->age_cnt;
+
+	if ((old & TSM_SCREEN_SYNC) && (flags & TSM_SCREEN_SYNC))
+		con->syncs++;
 }
 
 SHL_EXPORT
@@ -1005,6 +1617,14 @@ unsigned int tsm_screen_get_flags(struct tsm_screen *con)
 	return con->flags;
 }
 
+/* number of synchronized updates that ended, a change tells one ended even
+ * if the next one is under way already */
+SHL_EXPORT
+unsigned int tsm_screen_get_syncs(struct tsm_screen *con)
+{
+	return con->syncs;
+}
+
 SHL_EXPORT
 int tsm_screen_get_cursor_x(struct tsm_screen *con)
 {
@@ -1044,6 +1664,36 @@ void tsm_screen_reset_all_tabstops(struct tsm_screen *con)
 		con->tab_ruler[i] = false;
 }
 
+/* Zero width characters are combined with the character left of the
+ * cursor, the composed symbol gets its own id so it is drawn once. */
+static void screen_combine(struct tsm_screen *con, tsm_symbol_t ch)
+{
+	struct line *line;
+	struct cell *cell;
+	int x = con->cursor_x;
+
+	if (con->cursor_y >= con->size_y)
+		return;
+
+	line = con->lines[con->cursor_y];
+	if (x > con->size_x)
+		x = con->size_x;
+
+	/* skip back over the right half of wide characters */
+	while (x > 0 && !line->cells[x - 1].width)
+		--x;
+
+	if (!x || !line->cells[x - 1].ch)
+		return;
+
+	screen_inc_age(con);
+
+	cell = &line->cells[x - 1];
+	cell->ch = tsm_symbol_append(con->sym_table, cell->ch, ch);
+	cell->age = con->age_cnt;
+	screen_collect_symbols(con);
+}
+
 SHL_EXPORT
 void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 		      const struct tsm_screen_attr *attr)
@@ -1053,6 +1703,7 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 
 	len = tsm_symbol_get_width(con->sym_table, ch);
 	if (!len) {
+		screen_combine(con, ch);
 		return;
 	} else if (len < 0) {
 		ch = 0x0000fffd;
@@ -1068,10 +1719,13 @@ void tsm_screen_write(struct tsm_screen *con, tsm_symbol_t ch,
 		last = con->size_y - 1;
 
 	if (con->cursor_x >= con->size_x) {
-		if (con->flags & TSM_SCREEN_AUTO_WRAP)
+		if (con->flags & TSM_SCREEN_AUTO_WRAP) {
+			/* remembered to rewrap the text on resize */
+			con->lines[con->cursor_y]->wrapped = true;
 			move_cursor(con, 0, con->cursor_y + 1);
-		else
+		} else {
 			move_cursor(con, con->size_x - 1, con->cursor_y);
+		}
 	}
 
 	if (con->cursor_y > last) {
@@ -1314,8 +1968,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, int num)
 		return;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	get_cursor_cell(con)->age = con->age_cnt;
 
 	max = con->margin_bottom - con->cursor_y + 1;
 	if (num > max)
@@ -1328,6 +1981,7 @@ void tsm_screen_insert_lines(struct tsm_screen *con, int num)
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j],
 					 &con->def_attr);
+		cache[i]->wrapped = false;
 		if (con->cursor_y < con->vanguard)
 			con->vanguard++;
 	}
@@ -1339,9 +1993,13 @@ void tsm_screen_insert_lines(struct tsm_screen *con, int num)
 
 		memcpy(&con->lines[con->cursor_y],
 		       cache, num * sizeof(struct line*));
+
+		screen_lines_moved(con, con->cursor_y, con->margin_bottom,
+				   -num);
 	}
 
 	con->cursor_x = 0;
+	get_cursor_cell(con)->age = con->age_cnt;
 }
 
 SHL_EXPORT
@@ -1357,8 +2015,7 @@ void tsm_screen_delete_lines(struct tsm_screen *con, int num)
 		return;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	get_cursor_cell(con)->age = con->age_cnt;
 
 	max = con->margin_bottom - con->cursor_y + 1;
 	if (num > max)
@@ -1371,6 +2028,7 @@ void tsm_screen_delete_lines(struct tsm_screen *con, int num)
 		for (j = 0; j < con->size_x; ++j)
 			screen_cell_init(con, &cache[i]->cells[j],
 					 &con->def_attr);
+		cache[i]->wrapped = false;
 		if (con->cursor_y <= con->vanguard)
 			con->vanguard--;
 	}
@@ -1382,9 +2040,13 @@ void tsm_screen_delete_lines(struct tsm_screen *con, int num)
 
 		memcpy(&con->lines[con->cursor_y + (max - num)],
 		       cache, num * sizeof(struct line*));
+
+		screen_lines_moved(con, con->cursor_y, con->margin_bottom,
+				   num);
 	}
 
 	con->cursor_x = 0;
+	get_cursor_cell(con)->age = con->age_cnt;
 }
 
 SHL_EXPORT
@@ -1397,14 +2059,15 @@ void tsm_screen_insert_chars(struct tsm_screen *con, int num)
 		return;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
 
 	if (con->cursor_x >= con->size_x)
 		con->cursor_x = con->size_x - 1;
 	if (con->cursor_y >= con->size_y)
 		con->cursor_y = con->size_y - 1;
 
+	/* everything right of the cursor moves */
+	con->lines[con->cursor_y]->age = con->age_cnt;
+
 	max = con->size_x - con->cursor_x;
 	if (num > max)
 		num = max;
@@ -1431,14 +2094,15 @@ void tsm_screen_delete_chars(struct tsm_screen *con, int num)
 		return;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
 
 	if (con->cursor_x >= con->size_x)
 		con->cursor_x = con->size_x - 1;
 	if (con->cursor_y >= con->size_y)
 		con->cursor_y = con->size_y - 1;
 
+	/* everything right of the cursor moves */
+	con->lines[con->cursor_y]->age = con->age_cnt;
+
 	max = con->size_x - con->cursor_x;
 	if (num > max)
 		num = max;
@@ -0,0 +1,441 @@
+/*
+ * libtsm - Scroll-back Search
+ *
+ * Lines entering the scroll-back buffer are summarized in chunks of
+ * SEARCH_CHUNK lines. Each chunk keeps a bloom filter of the trigrams
+ * of its lines, case folded, and a pointer to its first line. Single
+ * characters and pairs go in as well, for needles shorter than three.
+ * A search only looks at the cells of chunks whose filter has every
+ * trigram of the needle and jumps over all others, so large buffers stay
+ * searchable at interactive speed. The visible screen is always scanned.
+ *
+ * Matches are shown with the selection, the view is scrolled to them.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libtsm.h"
+#include "libtsm-int.h"
+#include "shl-llog.h"
+
+#define LLOG_SUBSYSTEM "tsm-search"
+
+/* uppercase in the needle makes the search case sensitive */
+static uint32_t fold(uint32_t c)
+{
+	return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+/* stands in for the missing characters of pairs and single ones */
+#define NONE 0xffffffff
+
+static unsigned int trigram(uint32_t a, uint32_t b, uint32_t c)
+{
+	uint32_t h = a * 0x9e3779b1u + b * 0x85ebca77u + c * 0xc2b2ae3du;
+
+	return h >> (32 - SEARCH_BLOOM_ORDER);
+}
+
+static uint64_t chunk_of(uint64_t sb_id)
+{
+	return (sb_id - 1) / SEARCH_CHUNK;
+}
+
+static struct search_chunk *chunk_at(struct screen_search *s, uint64_t n)
+{
+	if (n < s->base || n - s->base >= s->count)
+		return NULL;
+
+	return &s->chunks[(s->head + (n - s->base)) % s->size];
+}
+
+/* the text of a line without the right halves of wide characters, with
+ * the cell every character starts at */
+static int line_text(struct screen_search *s, struct line *line)
+{
+	uint32_t *text;
+	int *cell;
+	int i, n = 0;
+
+	if (line->size > s->text_size) {
+		text = realloc(s->text, line->size * sizeof(*text));
+		if (!text)
+			return -ENOMEM;
+		s->text = text;
+
+		cell = realloc(s->cell, line->size * sizeof(*cell));
+		if (!cell)
+			return -ENOMEM;
+		s->cell = cell;
+
+		s->text_size = line->size;
+	}
+
+	for (i = 0; i < line->size; ++i) {
+		if (!line->cells[i].width)
+			continue;
+		s->text[n] = line->cells[i].ch ? line->cells[i].ch : ' ';
+		s->cell[n++] = i;
+	}
+
+	return n;
+}
+
+/* adds chunk @n after the newest one, or before the oldest if @front */
+static int chunk_push(struct screen_search *s, uint64_t n, struct line *first,
+		      bool front)
+{
+	struct search_chunk *chunks, *c;
+	size_t i, size;
+
+	if (s->count == s->size) {
+		size = s->size ? s->size * 2 : 16;
+		chunks = malloc(size * sizeof(*chunks));
+		if (!chunks)
+			return -ENOMEM;
+
+		for (i = 0; i < s->count; ++i)
+			chunks[i] = s->chunks[(s->head + i) % s->size];
+
+		free(s->chunks);
+		s->chunks = chunks;
+		s->size = size;
+		s->head = 0;
+	}
+
+	if (front) {
+		s->head = (s->head + s->size - 1) % s->size;
+		s->base = n;
+		c = &s->chunks[s->head];
+		++s->count;
+	} else {
+		if (!s->count)
+			s->base = n;
+		c = &s->chunks[(s->head + s->count++) % s->size];
+	}
+	memset(c, 0, sizeof(*c));
+	c->first = first;
+	return 0;
+}
+
+/* Called for every line linked into the scroll-back buffer, at the bottom
+ * or, rewrapped, at the top. */
+void screen_search_add(struct tsm_screen *con, struct line *line)
+{
+	struct screen_search *s = &con->search;
+	struct search_chunk *c;
+	uint64_t n = chunk_of(line->sb_id);
+	int i, len;
+
+	/* ids only ever go on by one, a gap means we lost track */
+	if (s->count && (n > s->base + s->count || n + 1 < s->base))
+		s->count = 0;
+
+	if (!chunk_at(s, n) &&
+	    chunk_push(s, n, line, s->count && n < s->base) < 0) {
+		/* without a summary this chunk could never be found */
+		s->count = 0;
+		return;
+	}
+
+	len = line_text(s, line);
+	if (len < 0) {
+		s->count = 0;
+		return;
+	}
+
+	c = chunk_at(s, n);
+	if (line->sb_id < c->first->sb_id)
+		c->first = line;
+	for (i = 0; i < len; ++i) {
+		uint32_t a = fold(s->text[i]);
+		uint32_t b = i + 1 < len ? fold(s->text[i + 1]) : NONE;
+		uint32_t d = i + 2 < len ? fold(s->text[i + 2]) : NONE;
+		unsigned int bit[3] = {
+			trigram(a, NONE, NONE),
+			trigram(a, b, NONE),
+			trigram(a, b, d)
+		};
+		int j;
+
+		for (j = 0; j < 3; ++j)
+			c->bits[bit[j] / 64] |= (uint64_t)1 << bit[j] % 64;
+	}
+}
+
+/* called before the first line of the scroll-back buffer is freed */
+void screen_search_drop(struct tsm_screen *con, struct line *line)
+{
+	struct screen_search *s = &con->search;
+	struct search_chunk *c = chunk_at(s, chunk_of(line->sb_id));
+
+	if (!c || c->first != line)
+		return;
+
+	if (line->next && chunk_of(line->next->sb_id) == chunk_of(line->sb_id)) {
+		c->first = line->next;
+	} else {
+		s->head = (s->head + 1) % s->size;
+		++s->base;
+		--s->count;
+	}
+}
+
+void screen_search_clear(struct tsm_screen *con)
+{
+	con->search.count = 0;
+	con->search.found = false;
+}
+
+void screen_search_free(struct tsm_screen *con)
+{
+	free(con->search.chunks);
+	free(con->search.text);
+	free(con->search.cell);
+	memset(&con->search, 0, sizeof(con->search));
+}
+
+/* whether the chunk may hold a line with every trigram of @str */
+static bool chunk_may(struct search_chunk *c, const uint32_t *str, size_t len)
+{
+	unsigned int bit;
+	size_t i;
+
+	if (len < 3) {
+		bit = trigram(fold(str[0]), len > 1 ? fold(str[1]) : NONE,
+			      NONE);
+		return c->bits[bit / 64] & (uint64_t)1 << bit % 64;
+	}
+
+	for (i = 0; i + 2 < len; ++i) {
+		bit = trigram(fold(str[i]), fold(str[i + 1]),
+			      fold(str[i + 2]));
+
+		if (!(c->bits[bit / 64] & (uint64_t)1 << bit % 64))
+			return false;
+	}
+
+	return true;
+}
+
+/* A row is either a line of the scroll-back buffer, with y < 0, or row y
+ * of the screen. */
+struct row {
+	struct line *line;
+	int y;
+};
+
+static bool row_step(struct tsm_screen *con, struct row *r, bool up)
+{
+	if (r->y >= 0) {
+		r->y += up ? -1 : 1;
+		if (r->y >= con->size_y)
+			return false;
+		if (r->y >= 0) {
+			r->line = con->lines[r->y];
+			return true;
+		}
+		if (!con->sb_last)
+			screen_sb_rewrap(con, SEARCH_CHUNK);
+		r->line = con->sb_last;
+		return r->line != NULL;
+	}
+
+	if (up) {
+		if (!r->line->prev)
+			screen_sb_rewrap(con, SEARCH_CHUNK);
+		r->line = r->line->prev;
+		return r->line != NULL;
+	}
+
+	if (r->line->next) {
+		r->line = r->line->next;
+		return true;
+	}
+
+	r->y = 0;
+	r->line = con->lines[0];
+	return true;
+}
+
+/* row of the last match, false if it is gone */
+static bool row_find(struct tsm_screen *con, struct row *r)
+{
+	struct screen_search *s = &con->search;
+
+	if (!s->id) {
+		if (s->y >= con->size_y)
+			return false;
+		r->y = s->y;
+		r->line = con->lines[s->y];
+		return true;
+	}
+
+	r->y = -1;
+	r->line = screen_sb_line(con, s->id);
+	return r->line != NULL;
+}
+
+/* Looks for @str in one line, before cell @limit going up or after it
+ * going down. */
+static bool search_line(struct tsm_screen *con, struct line *line,
+			const uint32_t *str, size_t len, bool cased,
+			bool up, int limit, int *from, int *to)
+{
+	struct screen_search *s = &con->search;
+	int n = line_text(s, line), i, step;
+	size_t j;
+
+	if (n < (int)len)
+		return false;
+
+	i = up ? n - (int)len : 0;
+	step = up ? -1 : 1;
+	for ( ; i >= 0 && i + (int)len <= n; i += step) {
+		if (up ? s->cell[i] >= limit : s->cell[i] <= limit)
+			continue;
+
+		for (j = 0; j < len; ++j) {
+			uint32_t c = s->text[i + j];
+
+			if ((cased ? c : fold(c)) != str[j])
+				break;
+		}
+
+		if (j == len) {
+			*from = s->cell[i];
+			*to = s->cell[i + len - 1];
+			*to += line->cells[*to].width - 1;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* scrolls just enough to have the row shown, to the middle if it was not */
+static void show_row(struct tsm_screen *con, struct row *r)
+{
+	uint64_t top, want;
+	int shown = screen_sb_shown(con);
+
+	if (r->y >= 0) {
+		if (r->y >= con->size_y - shown)
+			tsm_screen_sb_reset(con);
+		return;
+	}
+
+	top = con->sb_pos ? con->sb_pos->sb_id : con->sb_last_id + 1;
+	if (r->line->sb_id >= top && r->line->sb_id < top + con->size_y)
+		return;
+
+	want = r->line->sb_id > (uint64_t)con->size_y / 2 ?
+		r->line->sb_id - con->size_y / 2 : 0;
+	if (want < con->sb_first->sb_id)
+		want = con->sb_first->sb_id;
+
+	if (want < top)
+		tsm_screen_sb_up(con, top - want);
+	else
+		tsm_screen_sb_down(con, want - top);
+}
+
+/* Finds the next match of @str, older ones if @up, starting at the last
+ * match or at the bottom, going up, or the top, going down, after a
+ * reset. The match is selected and scrolled to. */
+SHL_EXPORT
+int tsm_screen_search(struct tsm_screen *con, const uint32_t *str,
+		      size_t len, bool up)
+{
+	struct screen_search *s = &con->search;
+	struct search_chunk *c;
+	uint64_t chunk = UINT64_MAX;
+	struct row r;
+	bool cased = false;
+	int limit, from, to;
+	size_t i;
+	uint32_t *needle;
+
+	if (!len)
+		return -EINVAL;
+
+	needle = malloc(len * sizeof(*needle));
+	if (!needle)
+		return -ENOMEM;
+
+	for (i = 0; i < len; ++i)
+		cased |= fold(str[i]) != str[i];
+	for (i = 0; i < len; ++i)
+		needle[i] = cased ? str[i] : fold(str[i]);
+
+	if (s->found && row_find(con, &r)) {
+		limit = s->x;
+	} else if (up) {
+		r.y = con->size_y - 1;
+		r.line = con->lines[r.y];
+		limit = INT32_MAX;
+	} else {
+		/* the top is the oldest line, wherever that is now */
+		screen_sb_rewrap(con, INT32_MAX);
+		r.y = con->sb_first ? -1 : 0;
+		r.line = con->sb_first ? con->sb_first : con->lines[0];
+		limit = -1;
+	}
+
+	for (;;) {
+		if (r.y < 0 && chunk_of(r.line->sb_id) != chunk) {
+			chunk = chunk_of(r.line->sb_id);
+			c = chunk_at(s, chunk);
+
+			/* skip the whole chunk */
+			if (c && !chunk_may(c, needle, len)) {
+				if (up) {
+					r.line = c->first;
+				} else {
+					c = chunk_at(s, chunk + 1);
+					if (c) {
+						r.line = c->first->prev;
+					} else {
+						r.line = con->sb_last;
+					}
+				}
+				limit = up ? INT32_MAX : -1;
+				if (!row_step(con, &r, up))
+					break;
+				continue;
+			}
+		}
+
+		if (search_line(con, r.line, needle, len, cased, up, limit,
+				&from, &to)) {
+			free(needle);
+
+			s->found = true;
+			s->id = r.y < 0 ? r.line->sb_id : 0;
+			s->y = r.y;
+			s->x = from;
+
+			show_row(con, &r);
+			screen_select(con, r.y < 0 ? r.line : NULL, r.y,
+				      from, to);
+			return 0;
+		}
+
+		limit = up ? INT32_MAX : -1;
+		if (!row_step(con, &r, up))
+			break;
+	}
+
+	free(needle);
+	return -ENOENT;
+}
+
+/* the next search starts over at the bottom or top */
+SHL_EXPORT
+void tsm_screen_search_reset(struct tsm_screen *con)
+{
+	con->search.found = false;
+}
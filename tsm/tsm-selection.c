@@ -97,24 +97,20 @@ static struct line *selection_set(struct tsm_screen *con,
 				  struct selection_pos *sel,
 				  int x, int y)
 {
-	struct line *pos;
+	int shown = screen_sb_shown(con);
 
 	sel->line = NULL;
-	pos = con->sb_pos;
-
-	while (y && pos) {
-		--y;
-		pos = pos->next;
-	}
-
 	sel->x = x;
-	sel->y = y;
 
-	if (pos) {
-		sel->line = pos;
+	if (y < shown) {
+		sel->y = 0;
+		sel->line = screen_sb_line(con, con->sb_pos->sb_id + y);
 		return sel->line;
 	}
 
+	y -= shown;
+	sel->y = y;
+
 	if (y < con->line_num)
 		return con->lines[y];
 
@@ -185,12 +181,43 @@ static void selection_adjust(struct tsm_screen *con, struct line *line)
 	}
 }
 
+/* row a selection position is shown in, -1 if above the shown rows */
+static int selection_row(struct tsm_screen *con, struct selection_pos *sel)
+{
+	if (sel->line) {
+		if (!con->sb_pos || sel->line->sb_id < con->sb_pos->sb_id)
+			return -1;
+		return sel->line->sb_id - con->sb_pos->sb_id;
+	}
+
+	if (sel->y == SELECTION_TOP)
+		return -1;
+
+	return sel->y + screen_sb_shown(con);
+}
+
+/* mark the rows covered by the selection as changed */
+static void selection_age(struct tsm_screen *con)
+{
+	int start, end;
+
+	if (!con->sel_active)
+		return;
+
+	start = selection_row(con, &con->sel_start);
+	end = selection_row(con, &con->sel_end);
+
+	if (start > end)
+		screen_age_rows(con, end, start);
+	else
+		screen_age_rows(con, start, end);
+}
+
 SHL_EXPORT
 void tsm_screen_selection_reset(struct tsm_screen *con)
 {
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	selection_age(con);
 
 	con->sel_active = false;
 }
@@ -203,8 +230,7 @@ void tsm_screen_selection_start(struct tsm_screen *con,
 	struct line *line;
 
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	selection_age(con);
 
 	con->sel_mode = mode;
 	con->sel_active = true;
@@ -214,6 +240,7 @@ void tsm_screen_selection_start(struct tsm_screen *con,
 	line = selection_set(con, &con->sel_start, posx, posy);
 	memcpy(&con->sel_end, &con->sel_start, sizeof(con->sel_end));
 	selection_adjust(con, line);
+	selection_age(con);
 }
 
 SHL_EXPORT
@@ -221,16 +248,34 @@ void tsm_screen_selection_target(struct tsm_screen *con, int posx, int posy)
 {
 	struct line *line;
 	screen_inc_age(con);
-	/* TODO: more sophisticated ageing */
-	con->age = con->age_cnt;
+	selection_age(con);
 
 	line = selection_set(con, &con->sel_end, posx, posy);
 	selection_adjust(con, line);
+	selection_age(con);
 
 	con->sel_target_x = posx;
 	con->sel_target_y = posy;
 }
 
+/* selects cells @from to @to of a line, @line if in sb or else row @y */
+void screen_select(struct tsm_screen *con, struct line *line, int y,
+		   int from, int to)
+{
+	screen_inc_age(con);
+	selection_age(con);
+
+	con->sel_mode = TSM_SM_CHAR;
+	con->sel_active = true;
+	con->sel_finished = true;
+	con->sel_start.line = line;
+	con->sel_start.x = from;
+	con->sel_start.y = line ? 0 : y;
+	memcpy(&con->sel_end, &con->sel_start, sizeof(con->sel_end));
+	con->sel_end.x = to;
+	selection_age(con);
+}
+
 SHL_EXPORT
 void tsm_screen_selection_finish(struct tsm_screen *con)
 {
@@ -245,44 +290,160 @@ void tsm_screen_selection_retarget(struct tsm_screen *con)
 					    con->sel_target_y);
 }
 
-/* TODO: tsm_ucs4_to_utf8 expects UCS4 characters, but a cell contains a
- * tsm-symbol (which can contain multiple UCS4 chars). Fix this when introducing
- * support for combining characters. */
-static int copy_line(struct line *line, char *buf, int start, size_t len)
+/* Reads the text of a selection in pieces of any size, without ever
+ * holding all of it. Rows are scroll-back lines by id, or screen rows with
+ * id 0. Scroll-back lines do not change, so they are read when asked for,
+ * skipping those dropped from the buffer meanwhile. Screen rows do, their
+ * part is taken when the reader is created. Only a resize rewrapping the
+ * buffer changes its lines, readers take the rest of their text then. */
+struct tsm_screen_selection_reader {
+	struct tsm_screen *con;		/* NULL once it holds its text */
+	struct tsm_screen_selection_reader *next, *prev;
+
+	uint64_t id, end_id;
+	uint64_t last_id;		/* last scroll-back line to read */
+	int y, end_y;
+	int x, end_x;			/* next cell, last cell of the last row */
+	bool done;
+
+	char *tail;			/* text of the selected screen rows */
+	size_t tail_len;
+
+	/* encoded cell, newline or tail not handed out yet */
+	char cell[TSM_UCS4_MAXLEN * 4];
+	const char *pending;
+	size_t pending_len, pending_pos;
+};
+
+static int reader_tail(struct tsm_screen *con,
+		       struct tsm_screen_selection_reader *r)
 {
-	int i, end;
-	char *pos = buf;
+	struct tsm_screen_selection_reader t;
+	size_t size = 0, n;
+	char *tail;
+
+	memcpy(&t, r, sizeof(t));
+	t.pending = t.cell;
+	if (t.id) {
+		t.id = 0;
+		t.y = 0;
+		t.x = 0;
+	}
+
+	do {
+		if (size - r->tail_len < 256) {
+			size = size ? size * 2 : 4096;
+			tail = realloc(r->tail, size);
+			if (!tail)
+				return -ENOMEM;
+			r->tail = tail;
+		}
 
-	end = start + len;
-	for (i = start; i < line->size && i < end; ++i) {
-		if (line->cells[i].ch)
-			pos += tsm_ucs4_to_utf8(line->cells[i].ch, pos);
+		n = tsm_screen_selection_read(con, &t, r->tail + r->tail_len,
+					      size - r->tail_len);
+		r->tail_len += n;
+	} while (n);
+
+	return 0;
+}
+
+static void reader_link(struct tsm_screen *con,
+			struct tsm_screen_selection_reader *r)
+{
+	r->con = con;
+	r->prev = NULL;
+	r->next = con->readers;
+	if (r->next)
+		r->next->prev = r;
+	con->readers = r;
+}
+
+static void reader_unlink(struct tsm_screen_selection_reader *r)
+{
+	if (!r->con)
+		return;
+
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		r->con->readers = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+	r->con = NULL;
+}
+
+/* Called before the lines of the scroll-back buffer change. Every reader
+ * reads the rest of its text into its tail, from where it is handed out. */
+void screen_selection_detach(struct tsm_screen *con)
+{
+	struct tsm_screen_selection_reader *r, t;
+	size_t size, len, n;
+	char *text, *tmp;
+
+	while ((r = con->readers)) {
+		reader_unlink(r);
+		if (r->done)
+			continue;
+
+		memcpy(&t, r, sizeof(t));
+		if (r->pending == r->cell)
+			t.pending = t.cell;
+
+		size = 0;
+		len = 0;
+		text = NULL;
+		do {
+			if (size - len < 256) {
+				size = size ? size * 2 : 4096;
+				tmp = realloc(text, size);
+				/* as much as we can hold */
+				if (!tmp)
+					break;
+				text = tmp;
+			}
+
+			n = tsm_screen_selection_read(con, &t, text + len,
+						      size - len);
+			len += n;
+		} while (n);
+
+		free(r->tail);
+		r->tail = text;
+		r->tail_len = len;
+		r->pending = text;
+		r->pending_len = len;
+		r->pending_pos = 0;
+		r->id = 0;
+		r->done = true;
 	}
+}
 
-	return pos - buf;
+static void reader_pos(struct tsm_screen *con, struct selection_pos *sel,
+		       uint64_t *id, int *y)
+{
+	*id = sel->line ? sel->line->sb_id : 0;
+	*y = sel->line ? 0 : sel->y;
+
+	if (!sel->line && sel->y == SELECTION_TOP) {
+		*id = con->sb_first ? con->sb_first->sb_id : 0;
+		*y = 0;
+	}
 }
 
-/* TODO: This beast definitely needs some "beautification", however, it's meant
- * as a "proof-of-concept" so its enough for now. */
 SHL_EXPORT
-int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
+int tsm_screen_selection_reader_new(struct tsm_screen *con,
+				    struct tsm_screen_selection_reader **out)
 {
-	int i;
-	size_t len;
+	struct tsm_screen_selection_reader *r;
 	struct selection_pos *start, *end;
-	struct line *iter;
-	char *str, *pos;
 
-	/* check whether sel_start or sel_end comes first */
-	if (!con->sel_start.line && con->sel_start.y == SELECTION_TOP) {
-		if (!con->sel_end.line && con->sel_end.y == SELECTION_TOP) {
-			str = strdup("");
-			if (!str)
-				return -ENOMEM;
-			*out = str;
-			return 0;
-		}
-	}
+	if (!con->sel_active)
+		return -ENOENT;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
 	if (anchor_first(con)) {
 		start = &con->sel_start;
 		end = &con->sel_end;
@@ -291,148 +452,243 @@ int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
 		end = &con->sel_start;
 	}
 
-	/* calculate size of buffer */
-	len = 0;
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
-
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
-			if (iter->size > start->x) {
-				if (iter->size > end->x)
-					len += end->x - start->x + 1;
-				else
-					len += iter->size - start->x;
-			}
-			break;
-		} else if (iter == start->line) {
-			if (iter->size > start->x)
-				len += iter->size - start->x;
-		} else if (iter == end->line) {
-			if (iter->size > end->x)
-				len += end->x + 1;
-			else
-				len += iter->size;
-			break;
-		} else {
-			len += iter->size;
-		}
+	/* nothing but the top of the buffer selected */
+	if (!end->line && end->y == SELECTION_TOP)
+		r->done = true;
+
+	reader_pos(con, start, &r->id, &r->y);
+	reader_pos(con, end, &r->end_id, &r->end_y);
+	r->x = start->line || start->y != SELECTION_TOP ? start->x : 0;
+	r->end_x = end->x;
+	r->last_id = r->end_id ? r->end_id : con->sb_last_id;
+	r->pending = r->cell;
 
-		++len;
-		iter = iter->next;
+	if (!r->done && !r->end_id && reader_tail(con, r) < 0) {
+		free(r->tail);
+		free(r);
+		return -ENOMEM;
 	}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
-			i = 0;
-		else
-			i = start->y;
-		for ( ; i < con->size_y; ++i) {
-			if (!start->line && start->y == i && end->y == i) {
-				if (con->size_x > start->x) {
-					if (con->size_x > end->x)
-						len += end->x - start->x + 1;
-					else
-						len += con->size_x - start->x;
-				}
-				break;
-			} else if (!start->line && start->y == i) {
-				if (con->size_x > start->x)
-					len += con->size_x - start->x;
-			} else if (end->y == i) {
-				if (con->size_x > end->x)
-					len += end->x + 1;
-				else
-					len += con->size_x;
-				break;
-			} else {
-				len += con->size_x;
-			}
+	reader_link(con, r);
+	*out = r;
+	return 0;
+}
+
+/* another reader of the same selection, at the same place */
+SHL_EXPORT
+int tsm_screen_selection_reader_dup(struct tsm_screen_selection_reader *r,
+				    struct tsm_screen_selection_reader **out)
+{
+	struct tsm_screen_selection_reader *dup;
 
-			++len;
+	dup = malloc(sizeof(*dup));
+	if (!dup)
+		return -ENOMEM;
+
+	memcpy(dup, r, sizeof(*dup));
+	if (r->tail) {
+		dup->tail = malloc(r->tail_len);
+		if (!dup->tail) {
+			free(dup);
+			return -ENOMEM;
 		}
+		memcpy(dup->tail, r->tail, r->tail_len);
 	}
+	dup->pending = r->pending == r->tail ? dup->tail : dup->cell;
+	if (r->con)
+		reader_link(r->con, dup);
 
-	/* allocate buffer */
-	len *= 4;
-	++len;
-	str = malloc(len);
-	if (!str)
-		return -ENOMEM;
-	pos = str;
-
-	/* copy data into buffer */
-	iter = start->line;
-	if (!iter && start->y == SELECTION_TOP)
-		iter = con->sb_first;
-
-	while (iter) {
-		if (iter == start->line && iter == end->line) {
-			if (iter->size > start->x) {
-				if (iter->size > end->x)
-					len = end->x - start->x + 1;
-				else
-					len = iter->size - start->x;
-				pos += copy_line(iter, pos, start->x, len);
-			}
-			break;
-		} else if (iter == start->line) {
-			if (iter->size > start->x)
-				pos += copy_line(iter, pos, start->x,
-						 iter->size - start->x);
-		} else if (iter == end->line) {
-			if (iter->size > end->x)
-				len = end->x + 1;
-			else
-				len = iter->size;
-			pos += copy_line(iter, pos, 0, len);
-			break;
-		} else {
-			pos += copy_line(iter, pos, 0, iter->size);
+	*out = dup;
+	return 0;
+}
+
+SHL_EXPORT
+void tsm_screen_selection_reader_free(struct tsm_screen_selection_reader *r)
+{
+	if (!r)
+		return;
+
+	reader_unlink(r);
+	free(r->tail);
+	free(r);
+}
+
+static struct line *reader_line(struct tsm_screen *con,
+				struct tsm_screen_selection_reader *r)
+{
+	struct line *line;
+
+	if (r->id) {
+		if (con->sb_first && r->id < con->sb_first->sb_id) {
+			r->id = con->sb_first->sb_id;
+			r->x = 0;
 		}
 
-		*pos++ = '\n';
-		iter = iter->next;
+		line = r->id <= r->last_id ? screen_sb_line(con, r->id) : NULL;
+		if (line)
+			return line;
+
+		/* the rest of the scroll-back buffer is gone */
+		if (r->end_id)
+			return NULL;
+		r->id = 0;
+		r->y = 0;
+		r->x = 0;
 	}
 
-	if (!end->line) {
-		if (start->line || start->y == SELECTION_TOP)
-			i = 0;
-		else
-			i = start->y;
-		for ( ; i < con->size_y; ++i) {
-			iter = con->lines[i];
-			if (!start->line && start->y == i && end->y == i) {
-				if (con->size_x > start->x) {
-					if (con->size_x > end->x)
-						len = end->x - start->x + 1;
-					else
-						len = con->size_x - start->x;
-					pos += copy_line(iter, pos, start->x, len);
-				}
-				break;
-			} else if (!start->line && start->y == i) {
-				if (con->size_x > start->x)
-					pos += copy_line(iter, pos, start->x,
-							 con->size_x - start->x);
-			} else if (end->y == i) {
-				if (con->size_x > end->x)
-					len = end->x + 1;
-				else
-					len = con->size_x;
-				pos += copy_line(iter, pos, 0, len);
+	if (r->y > r->end_y || r->y >= con->size_y)
+		return NULL;
+
+	return con->lines[r->y];
+}
+
+/* Encodes the rest of the current row into @buf, as far as it fits, and
+ * moves on to the next row. What does not fit is left pending. */
+static size_t reader_row(struct tsm_screen *con,
+			 struct tsm_screen_selection_reader *r,
+			 char *buf, size_t size)
+{
+	struct line *line = reader_line(con, r);
+	const uint32_t *ch;
+	struct cell *cell;
+	size_t i, len, n = 0;
+	int end;
+	bool last;
+
+	r->pending = r->cell;
+	r->pending_len = 0;
+	r->pending_pos = 0;
+
+	if (!r->id && r->tail) {
+		r->pending = r->tail;
+		r->pending_len = r->tail_len;
+		r->done = true;
+		return 0;
+	}
+
+	if (!line) {
+		r->done = true;
+		return 0;
+	}
+
+	last = r->id ? r->id == r->end_id : r->y == r->end_y;
+	end = line->size;
+	if (!r->id && end > con->size_x)
+		end = con->size_x;
+	if (last && end > r->end_x + 1)
+		end = r->end_x + 1;
+
+	while (r->x < end) {
+		cell = &line->cells[r->x];
+		if (!cell->ch || !cell->width) {
+			++r->x;
+			continue;
+		}
+
+		if (cell->ch < 0x80 && n < size) {
+			buf[n++] = cell->ch;
+			++r->x;
+			continue;
+		}
+
+		ch = tsm_symbol_get(con->sym_table, &cell->ch, &len);
+		for (i = 0; i < len; ++i)
+			r->pending_len += tsm_ucs4_to_utf8(ch[i],
+					r->cell + r->pending_len);
+		++r->x;
+
+		if (r->pending_len > size - n)
+			return n;
+		memcpy(buf + n, r->cell, r->pending_len);
+		n += r->pending_len;
+		r->pending_len = 0;
+	}
+
+	if (last) {
+		r->done = true;
+		return n;
+	}
+
+	if (n < size)
+		buf[n++] = '\n';
+	else
+		r->cell[r->pending_len++] = '\n';
+
+	r->x = 0;
+	if (!r->id)
+		++r->y;
+	else if (r->id == r->last_id)
+		r->id = 0;
+	else
+		++r->id;
+
+	return n;
+}
+
+/* Fills @buf with up to @size bytes of the selected text, as UTF-8 with
+ * rows ended by newlines. Returns 0 at the end. */
+SHL_EXPORT
+size_t tsm_screen_selection_read(struct tsm_screen *con,
+				 struct tsm_screen_selection_reader *r,
+				 char *buf, size_t size)
+{
+	size_t n = 0, len;
+
+	while (n < size) {
+		if (r->pending_pos == r->pending_len) {
+			if (r->done)
 				break;
-			} else {
-				pos += copy_line(iter, pos, 0, con->size_x);
-			}
+			n += reader_row(con, r, buf + n, size - n);
+			continue;
+		}
+
+		len = r->pending_len - r->pending_pos;
+		if (len > size - n)
+			len = size - n;
+		memcpy(buf + n, r->pending + r->pending_pos, len);
+		r->pending_pos += len;
+		n += len;
+	}
+
+	return n;
+}
+
+SHL_EXPORT
+int tsm_screen_selection_copy(struct tsm_screen *con, char **out)
+{
+	struct tsm_screen_selection_reader *r;
+	size_t len = 0, size = 4096, n;
+	char *str, *tmp;
+	int ret;
+
+	ret = tsm_screen_selection_reader_new(con, &r);
+	if (ret < 0)
+		return ret;
+
+	str = malloc(size);
+	if (!str) {
+		tsm_screen_selection_reader_free(r);
+		return -ENOMEM;
+	}
 
-			*pos++ = '\n';
+	while ((n = tsm_screen_selection_read(con, r, str + len,
+					      size - len - 1))) {
+		len += n;
+		if (size - len > 1)
+			continue;
+
+		tmp = realloc(str, size * 2);
+		if (!tmp) {
+			free(str);
+			tsm_screen_selection_reader_free(r);
+			return -ENOMEM;
 		}
+		str = tmp;
+		size *= 2;
 	}
 
-	/* return buffer */
-	*pos = 0;
+	tsm_screen_selection_reader_free(r);
+	str[len] = 0;
 	*out = str;
-	return pos - str;
+	return len;
 }
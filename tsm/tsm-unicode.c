@@ -55,12 +55,12 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include "libtsm.h"
 #include "libtsm-int.h"
-#include "shl-array.h"
-#include "shl-htable.h"
 
 /*
  * Unicode Symbol Handling
@@ -82,94 +82,287 @@
  * a valid UCS4 value, though. But no memory management is needed as all
  * tsm_symbol_t objects are simple integers.
  *
- * The symbol table contains two-way
- * references. The Hash Table contains all the symbols with the symbol ucs4
- * string as key and the symbol ID as value.
- * The index array contains the symbol ID as key and a pointer to the ucs4
- * string as value. But the hash table owns the ucs4 string.
- * This allows fast implementations of *_get() and *_append() without long
- * search intervals.
+ * The symbol table holds no pointers. The codepoints of all symbols are kept
+ * back to back in one arena, each symbol is an entry with its ID and the
+ * place of its codepoints in there. Two open addressing indexes, one by
+ * codepoints and one by ID, lead to the entries.
+ * IDs are shared by all tables. The IDs of dropped symbols are handed out
+ * again, each time with a higher reuse count. Renderers may cache glyphs by
+ * ID and reuse count, even across screens, as no two symbols ever have the
+ * same pair.
+ *
+ * Symbols no line uses anymore are dropped. Once as many new ones came in
+ * as were kept the last time, the screen marks the symbols of all its cells
+ * with a new generation, before it draws or right when the symbol that
+ * tipped it over was made, so screens nobody draws do not grow either.
+ * Entries of older generations go, the arena and the indexes are rebuilt
+ * from the rest. Arenas the last frame may have been drawn from are kept
+ * until the next one.
  *
  * When creating a new symbol, we simply return the UCS4 value as new symbol. We
  * do not add it to our symbol table as it is only one character. However, if a
- * character is appended to an existing symbol, we create a new ucs4 string and
- * push the new symbol into the symbol table.
+ * character is appended to an existing symbol, we look up the new ucs4 string
+ * and add it to the symbol table if it is not there yet.
  */
 
 const tsm_symbol_t tsm_symbol_default = 0;
 
+/* symbols coming in between two collections, at least */
+#define SYMBOL_COLLECT_MIN 1024
+
+/* IDs of combined symbols start right above the invalid codepoint */
+#define SYMBOL_ID_FIRST (TSM_UCS4_INVALID + 1)
+
+/* IDs reused this often are retired, the count has to fit in 30 bits */
+#define SYMBOL_REUSE_MAX ((1U << 30) - 1)
+
+struct symbol {
+	uint32_t id;
+	uint32_t reuse;			/* times the ID was handed out before */
+	uint32_t hash;			/* of the codepoints */
+	uint32_t gen;			/* last collection it was in use at */
+	uint32_t off;			/* first codepoint in the arena */
+	uint32_t len;
+};
+
 struct tsm_symbol_table {
 	unsigned long ref;
-	uint32_t next_id;
-	struct shl_array *index;
-	struct shl_htable symbols;
+
+	struct symbol *syms;		/* entries, oldest first */
+	uint32_t num, size;
+	uint32_t kept;			/* entries the last collection kept */
+	uint32_t gen;
+
+	/* entry index + 1 by codepoints and by ID, 0 in free slots */
+	uint32_t *by_text;
+	uint32_t *by_id;
+	uint32_t mask;			/* slots of each index - 1 */
+
+	uint32_t *text;			/* codepoints of all entries */
+	uint32_t text_len, text_size;
+	/* the arena before it last grew, the last frame may still have been
+	 * drawn from it */
+	uint32_t *old_text;
 };
 
-static size_t hash_ucs4(const void *key, void *priv)
+/* the IDs of all tables */
+static struct {
+	pthread_mutex_t lock;
+	uint64_t next;			/* never handed out yet */
+	uint32_t *reuse;		/* by ID - SYMBOL_ID_FIRST */
+	uint32_t reuse_size;
+	uint32_t *free;			/* dropped, to be handed out again */
+	uint32_t num_free, free_size;
+} ids = { PTHREAD_MUTEX_INITIALIZER, SYMBOL_ID_FIRST };
+
+/* makes room for the reuse count of one more new ID */
+static bool id_reserve(void)
+{
+	uint32_t *r, size;
+
+	if (ids.next - SYMBOL_ID_FIRST < ids.reuse_size)
+		return true;
+
+	size = ids.reuse_size ? ids.reuse_size * 2 : 1024;
+	r = realloc(ids.reuse, size * sizeof(*r));
+	if (!r)
+		return false;
+
+	ids.reuse = r;
+	ids.reuse_size = size;
+	return true;
+}
+
+/* hands out an ID and its reuse count, returns false if there is none */
+static bool id_get(uint32_t *id, uint32_t *reuse)
 {
-	size_t i, val = 5381;
-	const uint32_t *ucs4 = key;
+	bool ok = true;
+
+	pthread_mutex_lock(&ids.lock);
+	if (ids.num_free) {
+		*id = ids.free[--ids.num_free];
+		*reuse = ++ids.reuse[*id - SYMBOL_ID_FIRST];
+	} else if (ids.next > UINT32_MAX || !id_reserve()) {
+		/* all 2 billion in use or no memory, unlikely but lets be
+		 * safe here */
+		ok = false;
+	} else {
+		*id = ids.next++;
+		*reuse = ids.reuse[*id - SYMBOL_ID_FIRST] = 0;
+	}
+	pthread_mutex_unlock(&ids.lock);
+
+	return ok;
+}
+
+/* gives back the IDs of the entries not marked since the last frame, or
+ * of @all of them */
+static void id_put(struct tsm_symbol_table *tbl, bool all)
+{
+	uint32_t *f, size, i;
+
+	pthread_mutex_lock(&ids.lock);
+	for (i = 0; i < tbl->num; ++i) {
+		if ((!all && tbl->syms[i].gen == tbl->gen) ||
+		    tbl->syms[i].reuse >= SYMBOL_REUSE_MAX)
+			continue;
+
+		if (ids.num_free == ids.free_size) {
+			size = ids.free_size ? ids.free_size * 2 : 1024;
+			f = realloc(ids.free, size * sizeof(*f));
+			/* without memory the ID is lost, there are plenty */
+			if (!f)
+				break;
+			ids.free = f;
+			ids.free_size = size;
+		}
+		ids.free[ids.num_free++] = tbl->syms[i].id;
+	}
+	pthread_mutex_unlock(&ids.lock);
+}
+
+static uint32_t hash_ucs4(const uint32_t *ucs4, size_t len)
+{
+	uint32_t val = 5381;
+	size_t i;
 
-	for (i = 0; ucs4[i] <= TSM_UCS4_MAX; ++i)
+	for (i = 0; i < len; ++i)
 		val = val * 33 + ucs4[i];
 
 	return val;
 }
 
-static bool cmp_ucs4(const void *a, const void *b)
+/* the slot of the codepoints in the index, or the free one they would go to */
+static uint32_t *slot_text(struct tsm_symbol_table *tbl, const uint32_t *ucs4,
+			   size_t len, uint32_t hash)
 {
-	size_t i;
-	const uint32_t *v1, *v2;
+	struct symbol *s;
+	uint32_t i;
+
+	for (i = hash & tbl->mask; tbl->by_text[i]; i = (i + 1) & tbl->mask) {
+		s = &tbl->syms[tbl->by_text[i] - 1];
+		if (s->hash == hash && s->len == len &&
+		    !memcmp(tbl->text + s->off, ucs4, len * sizeof(*ucs4)))
+			break;
+	}
 
-	v1 = a;
-	v2 = b;
+	return &tbl->by_text[i];
+}
+
+/* IDs are handed out in order, they spread over the slots by themselves */
+static uint32_t *slot_id(struct tsm_symbol_table *tbl, uint32_t id)
+{
+	uint32_t i;
 
-	for (i = 0; ; ++i) {
-		if (v1[i] > TSM_UCS4_MAX && v2[i] > TSM_UCS4_MAX)
-			return true;
-		if (v1[i] != v2[i])
-			return false;
+	for (i = id & tbl->mask; tbl->by_id[i]; i = (i + 1) & tbl->mask) {
+		if (tbl->syms[tbl->by_id[i] - 1].id == id)
+			break;
 	}
+
+	return &tbl->by_id[i];
 }
 
-static void free_ucs4(void *elem, void *priv)
+/* Rebuilds both indexes with @size slots each. Without memory for them,
+ * the old ones are reused if they are big enough. */
+static int index_build(struct tsm_symbol_table *tbl, uint32_t size)
 {
-	uint32_t *v = elem;
+	uint32_t *by_text, *by_id, i;
+
+	by_text = calloc(size, sizeof(*by_text));
+	by_id = calloc(size, sizeof(*by_id));
+	if (by_text && by_id) {
+		free(tbl->by_text);
+		free(tbl->by_id);
+		tbl->by_text = by_text;
+		tbl->by_id = by_id;
+		tbl->mask = size - 1;
+	} else {
+		free(by_text);
+		free(by_id);
+		if (!tbl->by_text || (tbl->num + 1) * 2 > tbl->mask + 1)
+			return -ENOMEM;
+		memset(tbl->by_text, 0, (tbl->mask + 1) * sizeof(*by_text));
+		memset(tbl->by_id, 0, (tbl->mask + 1) * sizeof(*by_id));
+	}
+
+	for (i = 0; i < tbl->num; ++i) {
+		*slot_text(tbl, tbl->text + tbl->syms[i].off, tbl->syms[i].len,
+			   tbl->syms[i].hash) = i + 1;
+		*slot_id(tbl, tbl->syms[i].id) = i + 1;
+	}
+
+	return 0;
+}
 
-	/* key is prefix with actual value so pass correct pointer */
-	free(--v);
+/* The arena is about to be replaced. The last frame was drawn from the
+ * parked one if there is one, else from this one, which is parked then. */
+static void text_retire(struct tsm_symbol_table *tbl)
+{
+	if (tbl->old_text)
+		free(tbl->text);
+	else
+		tbl->old_text = tbl->text;
+}
+
+/* makes room for one more entry of @len codepoints */
+static int symbol_reserve(struct tsm_symbol_table *tbl, size_t len)
+{
+	struct symbol *syms;
+	uint32_t *text, size;
+
+	if (tbl->num == tbl->size) {
+		size = tbl->size * 2;
+		syms = realloc(tbl->syms, size * sizeof(*syms));
+		if (!syms)
+			return -ENOMEM;
+		tbl->syms = syms;
+		tbl->size = size;
+	}
+
+	if (tbl->text_size - tbl->text_len < len) {
+		size = tbl->text_size * 2;
+		text = malloc(size * sizeof(*text));
+		if (!text)
+			return -ENOMEM;
+		memcpy(text, tbl->text, tbl->text_len * sizeof(*text));
+
+		text_retire(tbl);
+		tbl->text = text;
+		tbl->text_size = size;
+	}
+
+	/* indexes stay at most half full */
+	if ((tbl->num + 1) * 2 > tbl->mask + 1)
+		return index_build(tbl, (tbl->mask + 1) * 2);
+
+	return 0;
 }
 
 int tsm_symbol_table_new(struct tsm_symbol_table **out)
 {
 	struct tsm_symbol_table *tbl;
-	int ret;
-	static const uint32_t *val = NULL; /* we need a valid lvalue */
 
 	if (!out)
 		return -EINVAL;
 
-	tbl = malloc(sizeof(*tbl));
+	tbl = calloc(1, sizeof(*tbl));
 	if (!tbl)
 		return -ENOMEM;
-	memset(tbl, 0, sizeof(*tbl));
 	tbl->ref = 1;
-	tbl->next_id = TSM_UCS4_MAX + 2;
-	shl_htable_init(&tbl->symbols, cmp_ucs4, hash_ucs4, NULL);
-
-	ret = shl_array_new(&tbl->index, sizeof(uint32_t*), 4);
-	if (ret)
-		goto err_free;
-
-	/* first entry is not used so add dummy */
-	shl_array_push(tbl->index, &val);
+	tbl->size = 64;
+	tbl->text_size = 1024;
+
+	tbl->syms = malloc(tbl->size * sizeof(*tbl->syms));
+	tbl->text = malloc(tbl->text_size * sizeof(*tbl->text));
+	if (!tbl->syms || !tbl->text || index_build(tbl, 128) < 0) {
+		free(tbl->syms);
+		free(tbl->text);
+		free(tbl);
+		return -ENOMEM;
+	}
 
 	*out = tbl;
 	return 0;
-
-err_free:
-	free(tbl);
-	return ret;
 }
 
 void tsm_symbol_table_ref(struct tsm_symbol_table *tbl)
@@ -185,11 +378,101 @@ void tsm_symbol_table_unref(struct tsm_symbol_table *tbl)
 	if (!tbl || !tbl->ref || --tbl->ref)
 		return;
 
-	shl_htable_clear(&tbl->symbols, free_ucs4, NULL);
-	shl_array_free(tbl->index);
+	id_put(tbl, true);
+	free(tbl->syms);
+	free(tbl->by_text);
+	free(tbl->by_id);
+	free(tbl->text);
+	free(tbl->old_text);
 	free(tbl);
 }
 
+/* Called before a frame is drawn, nothing points into arenas the last one
+ * was drawn from anymore. */
+void tsm_symbol_table_frame(struct tsm_symbol_table *tbl)
+{
+	free(tbl->old_text);
+	tbl->old_text = NULL;
+}
+
+/* Returns true if the unused symbols are to be dropped: every symbol in use
+ * is marked, then the table collected. */
+bool tsm_symbol_table_due(struct tsm_symbol_table *tbl)
+{
+	uint32_t min;
+
+	min = tbl->kept > SYMBOL_COLLECT_MIN ? tbl->kept : SYMBOL_COLLECT_MIN;
+	if (tbl->num - tbl->kept < min)
+		return false;
+
+	++tbl->gen;
+	return true;
+}
+
+void tsm_symbol_mark(struct tsm_symbol_table *tbl, tsm_symbol_t sym)
+{
+	uint32_t e;
+
+	if (sym <= TSM_UCS4_MAX)
+		return;
+
+	e = *slot_id(tbl, sym);
+	if (e)
+		tbl->syms[e - 1].gen = tbl->gen;
+}
+
+/* drops the symbols not marked since tsm_symbol_table_due() */
+void tsm_symbol_table_collect(struct tsm_symbol_table *tbl)
+{
+	uint32_t *text, i, n = 0, len = 0, size = 1024;
+	struct symbol *syms;
+
+	for (i = 0; i < tbl->num; ++i)
+		if (tbl->syms[i].gen == tbl->gen)
+			len += tbl->syms[i].len;
+
+	/* the live ones move to a fresh arena with room to grow */
+	while (size < len * 2)
+		size *= 2;
+	text = malloc(size * sizeof(*text));
+	if (!text)
+		return;
+
+	id_put(tbl, false);
+
+	len = 0;
+	for (i = 0; i < tbl->num; ++i) {
+		if (tbl->syms[i].gen != tbl->gen)
+			continue;
+		memcpy(text + len, tbl->text + tbl->syms[i].off,
+		       tbl->syms[i].len * sizeof(*text));
+		tbl->syms[n] = tbl->syms[i];
+		tbl->syms[n++].off = len;
+		len += tbl->syms[i].len;
+	}
+
+	text_retire(tbl);
+	tbl->text = text;
+	tbl->text_len = len;
+	tbl->text_size = size;
+	tbl->num = n;
+	tbl->kept = n;
+
+	size = 64;
+	while (size < n * 2)
+		size *= 2;
+	if (size < tbl->size) {
+		syms = realloc(tbl->syms, size * sizeof(*syms));
+		if (syms) {
+			tbl->syms = syms;
+			tbl->size = size;
+		}
+	}
+
+	/* the old indexes are big enough if the new ones do not fit */
+	index_build(tbl, size * 2);
+}
+
 tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
 {
 	if (ucs4 > TSM_UCS4_MAX)
@@ -204,7 +487,7 @@ tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
  * Therefore, the returned value may get destroyed if your \sym argument gets
  * destroyed.
  * If \sym is a composed ucs4 string, then the returned value points into the
- * hash table of the symbol table and lives as long as the symbol table does.
+ * arena of the symbol table. It stays valid until the next frame is drawn.
  *
  * This always returns a valid value. If an error happens, the default character
  * is returned. If \size is NULL, then the size value is omitted.
@@ -212,7 +495,8 @@ tsm_symbol_t tsm_symbol_make(uint32_t ucs4)
 const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t *sym, size_t *size)
 {
-	uint32_t *ucs4, idx;
+	struct symbol *s;
+	uint32_t e;
 
 	if (*sym <= TSM_UCS4_MAX) {
 		if (size)
@@ -223,35 +507,44 @@ const uint32_t *tsm_symbol_get(struct tsm_symbol_table *tbl,
 	if (!tbl)
 		return sym;
 
-	idx = *sym - (TSM_UCS4_MAX + 1);
-	if (idx >= shl_array_get_length(tbl->index))
-		ucs4 = NULL;
-	else
-		ucs4 = *SHL_ARRAY_AT(tbl->index, uint32_t*, idx);
-
-	if (!ucs4) {
+	e = *slot_id(tbl, *sym);
+	if (!e) {
 		if (size)
 			*size = 1;
 		return &tsm_symbol_default;
 	}
 
-	if (size) {
-		*size = 0;
-		while (ucs4[*size] <= TSM_UCS4_MAX)
-			++*size;
-	}
+	s = &tbl->syms[e - 1];
+	if (size)
+		*size = s->len;
+
+	return tbl->text + s->off;
+}
+
+/* what renderers know @sym by: the codepoint, or the ID of a combined symbol
+ * with its reuse count in the upper half */
+uint64_t tsm_symbol_draw_id(struct tsm_symbol_table *tbl, tsm_symbol_t sym)
+{
+	uint32_t e;
+
+	if (sym <= TSM_UCS4_MAX || !tbl)
+		return sym;
+
+	e = *slot_id(tbl, sym);
+	if (!e)
+		return tsm_symbol_default;
 
-	return ucs4;
+	return (uint64_t)tbl->syms[e - 1].reuse << 32 | sym;
 }
 
 tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 			       tsm_symbol_t sym, uint32_t ucs4)
 {
-	uint32_t buf[TSM_UCS4_MAXLEN + 1], nsym, *nval;
+	uint32_t buf[TSM_UCS4_MAXLEN], hash, e;
 	const uint32_t *ptr;
-	size_t s;
-	bool res;
-	int ret;
+	uint32_t id, reuse;
+	struct symbol *s;
+	size_t len;
 
 	if (!tbl)
 		return sym;
@@ -259,55 +552,38 @@ tsm_symbol_t tsm_symbol_append(struct tsm_symbol_table *tbl,
 	if (ucs4 > TSM_UCS4_MAX)
 		return sym;
 
-	ptr = tsm_symbol_get(tbl, &sym, &s);
-	if (s >= TSM_UCS4_MAXLEN)
+	ptr = tsm_symbol_get(tbl, &sym, &len);
+	if (len >= TSM_UCS4_MAXLEN)
 		return sym;
 
-	memcpy(buf, ptr, s * sizeof(uint32_t));
-	buf[s++] = ucs4;
-	buf[s++] = TSM_UCS4_MAX + 1;
+	memcpy(buf, ptr, len * sizeof(uint32_t));
+	buf[len++] = ucs4;
 
-	res = shl_htable_lookup(&tbl->symbols, buf, hash_ucs4(buf, NULL),
-				(void**)&nval);
-	if (res) {
-		/* key is prefixed with actual value */
-		return *--nval;
-	}
+	hash = hash_ucs4(buf, len);
+	e = *slot_text(tbl, buf, len, hash);
+	if (e)
+		return tbl->syms[e - 1].id;
 
-	/* We save the key in nval and prefix it with the new ID. Note that
-	 * the prefix is hidden, we actually store "++nval" in the htable. */
-	nval = malloc(sizeof(uint32_t) * (s + 1));
-	if (!nval)
+	if (symbol_reserve(tbl, len) < 0)
 		return sym;
 
-	++nval;
-	memcpy(nval, buf, s * sizeof(uint32_t));
-
-	nsym = tbl->next_id + 1;
-	/* Out of IDs; we actually have 2 Billion IDs so this seems
-	 * very unlikely but lets be safe here */
-	if (nsym <= tbl->next_id++)
-		goto err_id;
-
-	/* store ID hidden before the key */
-	*(nval - 1) = nsym;
-
-	ret = shl_htable_insert(&tbl->symbols, nval, hash_ucs4(nval, NULL));
-	if (ret)
-		goto err_id;
+	if (!id_get(&id, &reuse))
+		return sym;
 
-	ret = shl_array_push(tbl->index, &nval);
-	if (ret)
-		goto err_symbol;
+	s = &tbl->syms[tbl->num++];
+	s->id = id;
+	s->reuse = reuse;
+	s->hash = hash;
+	s->gen = tbl->gen;
+	s->off = tbl->text_len;
+	s->len = len;
+	memcpy(tbl->text + s->off, buf, len * sizeof(uint32_t));
+	tbl->text_len += len;
 
-	return nsym;
+	*slot_text(tbl, buf, len, hash) = tbl->num;
+	*slot_id(tbl, id) = tbl->num;
 
-err_symbol:
-	shl_htable_remove(&tbl->symbols, nval, hash_ucs4(nval, NULL), NULL);
-err_id:
-	--tbl->next_id;
-	free(nval);
-	return sym;
+	return id;
 }
 
 int tsm_symbol_get_width(struct tsm_symbol_table *tbl,
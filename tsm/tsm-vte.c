@@ -466,6 +466,7 @@ static void reset_state(struct tsm_vte *vte)
 	copy_fcolor(&vte->saved_state.cattr, &vte->def_attr);
 	copy_bcolor(&vte->saved_state.cattr, &vte->def_attr);
 	vte->saved_state.cattr.bold = 0;
+	vte->saved_state.cattr.italic = 0;
 	vte->saved_state.cattr.underline = 0;
 	vte->saved_state.cattr.inverse = 0;
 	vte->saved_state.cattr.protect = 0;
@@ -955,6 +956,7 @@ static void csi_attribute(struct tsm_vte *vte)
 			copy_fcolor(&vte->cattr, &vte->def_attr);
 			copy_bcolor(&vte->cattr, &vte->def_attr);
 			vte->cattr.bold = 0;
+			vte->cattr.italic = 0;
 			vte->cattr.underline = 0;
 			vte->cattr.inverse = 0;
 			vte->cattr.blink = 0;
@@ -962,6 +964,9 @@ static void csi_attribute(struct tsm_vte *vte)
 		case 1:
 			vte->cattr.bold = 1;
 			break;
+		case 3:
+			vte->cattr.italic = 1;
+			break;
 		case 4:
 			vte->cattr.underline = 1;
 			break;
@@ -974,6 +979,9 @@ static void csi_attribute(struct tsm_vte *vte)
 		case 22:
 			vte->cattr.bold = 0;
 			break;
+		case 23:
+			vte->cattr.italic = 0;
+			break;
 		case 24:
 			vte->cattr.underline = 0;
 			break;
@@ -1397,6 +1405,14 @@ static void csi_mode(struct tsm_vte *vte, bool set)
 		case 2004:
 			set_reset_flag(vte, set, FLAG_BRACKETED_PASTE_MODE);
 			continue;
+		case 2026: /* Synchronized output */
+			if (set)
+				tsm_screen_set_flags(vte->con,
+						     TSM_SCREEN_SYNC);
+			else
+				tsm_screen_reset_flags(vte->con,
+						       TSM_SCREEN_SYNC);
+			continue;
 		default:
 			llog_debug(vte, "unknown DEC %set-Mode %d",
 				   set?"S":"Res", vte->csi_argv[i]);
@@ -1440,6 +1456,37 @@ static void csi_dsr(struct tsm_vte *vte)
 	}
 }
 
+/* only answers for the DEC private modes applications probe for */
+static void csi_decrqm(struct tsm_vte *vte)
+{
+	unsigned int flags = tsm_screen_get_flags(vte->con);
+	int mode = vte->csi_argv[0], state;
+	char buf[64];
+	unsigned int len;
+
+	switch (mode) {
+	case 25:
+		state = flags & TSM_SCREEN_HIDE_CURSOR ? 2 : 1;
+		break;
+	case 1049:
+		state = flags & TSM_SCREEN_ALTERNATE ? 1 : 2;
+		break;
+	case 2004:
+		state = vte->flags & FLAG_BRACKETED_PASTE_MODE ? 1 : 2;
+		break;
+	case 2026:
+		state = flags & TSM_SCREEN_SYNC ? 1 : 2;
+		break;
+	default:
+		state = 0;
+		break;
+	}
+
+	len = snprintf(buf, sizeof(buf), "\e[?%d;%d$y", mode, state);
+	if (len < sizeof(buf))
+		vte_write(vte, buf, len);
+}
+
 static void do_csi(struct tsm_vte *vte, uint32_t data)
 {
 	int num, x, y, upper, lower;
@@ -1590,8 +1637,8 @@ static void do_csi(struct tsm_vte *vte, uint32_t data)
 			csi_soft_reset(vte);
 		} else if (vte->csi_flags & CSI_CASH) {
 			/* DECRQM: Request DEC Private Mode */
-			/* If CSI_WHAT is set, then enable,
-			 * otherwise disable */
+			if (vte->csi_flags & CSI_WHAT)
+				csi_decrqm(vte);
 		} else {
 			/* DECSCL: Compatibility Level */
 			/* Sometimes CSI_DQUOTE is set here, too */